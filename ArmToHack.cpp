@@ -1,10 +1,15 @@
 #include "ArmToHack.h"
+#include "HackLinker.h"
 #include <vector>
+#include <set>
 #include <cmath>
+#include <cctype>
 
 using namespace std;
 
-ArmToHack::ArmToHack() : line_number(0), current_memory_location(16) {
+ArmToHack::ArmToHack()
+    : line_number(0), inlined_words(0), inline_threshold(DEFAULT_INLINE_THRESHOLD), flow_graph(register_map),
+      current_line(0) {
     for (int i = 0; i <= 15; i++) {
         string reg = "R" + to_string(i);
         register_map[reg] = i;
@@ -14,6 +19,9 @@ ArmToHack::ArmToHack() : line_number(0), current_memory_location(16) {
     register_map["SP"] = 13;
     register_map["LR"] = 14;
     register_map["PC"] = 15;
+
+    for (int i = 0; i < POINTER_SLOTS; i++)
+        register_map["$P" + to_string(i)] = MemoryPlanner::REGISTER_COUNT + i;
     
     jump_map["BEQ"] = "JEQ";  
     jump_map["BNE"] = "JNE";  
@@ -24,73 +32,407 @@ ArmToHack::ArmToHack() : line_number(0), current_memory_location(16) {
     jump_map["BAL"] = "JMP";  
 }
 
+// Leaf functions with at most this many instructions are inlined at their
+// BL call sites; 0 turns inlining off.
+void ArmToHack::setInlineThreshold(int max_instructions) {
+    inline_threshold = max_instructions;
+}
+
 void ArmToHack::clearState() {
     line_number = 0;
+    module.clear();
     label_map.clear();
-    hack_line_to_label_map.clear();
     variable_map.clear();
-    current_memory_location = 16;
+    source_lines.clear();
+    rewritten_text.clear();
+    inlined_lines.clear();
+    inlined_words = 0;
+    flow_graph.clear();
+    current_line = 0;
+    invalidateTracking();
 }
 
 void ArmToHack::emitLine(const string& line) {
-    if (output_stream.is_open()) {
-        output_stream << line << endl;
-        line_number++;
+    module.code.push_back(line);
+    line_number++;
+    trackInstruction(line);
+}
+
+// Follows what A and D hold within a basic block: a_value and d_value name
+// the constant last loaded into them ("" when unknown) and d_cells lists the
+// RAM cells known to hold the same value as D. Labels and jumps reset it.
+void ArmToHack::trackInstruction(const string& line) {
+    if (line[0] == '@') {
+        a_value = line.substr(1);
+        if (a_value.size() > 1 && a_value[0] == 'R' && isdigit(a_value[1]))
+            a_value = a_value.substr(1);
+        return;
+    }
+
+    size_t equals = line.find('=');
+    size_t semicolon = line.find(';');
+    size_t comp_start = (equals == string::npos) ? 0 : equals + 1;
+    string dest = (equals == string::npos) ? "" : line.substr(0, equals);
+    string comp = line.substr(comp_start, semicolon == string::npos ? string::npos : semicolon - comp_start);
+    string jump = (semicolon == string::npos) ? "" : line.substr(semicolon + 1);
+
+    bool writes_m = dest.find('M') != string::npos;
+    bool writes_d = dest.find('D') != string::npos;
+
+    if (writes_m) {
+        if (a_value.empty())
+            d_cells.clear();
+        else if (comp == "D")
+            d_cells.insert(a_value);
+        else
+            d_cells.erase(a_value);
+    }
+
+    if (writes_d && comp != "D") {
+        if (comp == "M" && !a_value.empty()) {
+            if (!d_cells.count(a_value)) {
+                d_cells.clear();
+                d_cells.insert(a_value);
+                d_value.clear();
+            }
+        } else if (comp == "A" && !a_value.empty()) {
+            d_value = a_value;
+            d_cells.clear();
+        } else if (comp == "-D" && !d_value.empty() && isdigit(d_value[0])) {
+            d_value = "-" + d_value;
+            d_cells.clear();
+        } else {
+            d_value.clear();
+            d_cells.clear();
+        }
+        if (writes_m && !a_value.empty())
+            d_cells.insert(a_value);
+    }
+
+    if (dest.find('A') != string::npos)
+        a_value.clear();
+
+    if (jump == "JMP")
+        invalidateTracking();
+}
+
+void ArmToHack::invalidateTracking() {
+    a_value.clear();
+    d_value.clear();
+    d_cells.clear();
+}
+
+// Tracking name of a register cell; loop pointers live in scratch slots.
+string ArmToHack::cellName(int addr) const {
+    if (addr < MemoryPlanner::REGISTER_COUNT)
+        return to_string(addr);
+    return "T" + to_string(SCRATCH_POINTER + addr - MemoryPlanner::REGISTER_COUNT);
+}
+
+void ArmToHack::emitAddress(int addr) {
+    if (a_value == cellName(addr))
+        return;
+    if (addr < MemoryPlanner::REGISTER_COUNT)
+        emitLine("@" + to_string(addr));
+    else
+        emitScratchReference(SCRATCH_POINTER + addr - MemoryPlanner::REGISTER_COUNT);
+}
+
+void ArmToHack::loadRegister(int addr) {
+    if (d_cells.count(cellName(addr)))
+        return;
+    emitAddress(addr);
+    emitLine("D=M");
+}
+
+void ArmToHack::storeRegister(int addr) {
+    if (d_cells.count(cellName(addr)))
+        return;
+    emitAddress(addr);
+    emitLine("M=D");
+}
+
+void ArmToHack::loadConstant(int value) {
+    if (d_value == to_string(value))
+        return;
+
+    if (value < 0) {
+        emitLine("@" + to_string(-value));  
+        emitLine("D=A");
+        emitLine("D=-D");
+    } else {
+        emitLine("@" + to_string(value));
+        emitLine("D=A");
+    }
+}
+
+// Writes an instruction's result back to its register unless liveness shows
+// the register is overwritten or never read before control leaves the module.
+void ArmToHack::storeResult(int addr) {
+    if (!flow_graph.isLiveAfter(current_line, addr)) {
+        module.stats["dead_register_stores"]++;
+        return;
     }
+    storeRegister(addr);
+}
+
+void ArmToHack::emitSymbolReference(const string& symbol) {
+    Relocation reloc;
+    reloc.line = line_number;
+    reloc.kind = RELOC_SYMBOL;
+    reloc.symbol = symbol;
+    reloc.addend = 0;
+    module.relocations.push_back(reloc);
+    emitLine("@-1");
+    a_value = "S" + symbol;
+}
+
+void ArmToHack::emitRomReference(int line) {
+    Relocation reloc;
+    reloc.line = line_number;
+    reloc.kind = RELOC_ROM;
+    reloc.addend = line;
+    module.relocations.push_back(reloc);
+    emitLine("@" + to_string(line));
+    a_value = "P" + to_string(line);
+}
+
+void ArmToHack::emitScratchReference(int slot) {
+    Relocation reloc;
+    reloc.line = line_number;
+    reloc.kind = RELOC_SCRATCH;
+    reloc.addend = slot;
+    module.relocations.push_back(reloc);
+    emitLine("@" + to_string(16 + slot));
+    a_value = "T" + to_string(slot);
 }
 
 void ArmToHack::convertFile(const string& in_filename, const string& out_filename) {
-    string tmp_filename = in_filename + ".tmp";
-    firstPass(in_filename, tmp_filename);
-    secondPass(tmp_filename, out_filename);
+    if (!output_sink.open(out_filename))
+        return;
+    convertFile(in_filename, output_sink);
+    output_sink.close();
 }
 
-void ArmToHack::firstPass(const string& in_filename, const string& out_filename) {
+bool ArmToHack::convertFile(const string& in_filename, OutputSink& sink) {
+    HackObject object;
+    if (!compileModule(in_filename, object))
+        return false;
+
+    HackLinker linker;
+    linker.addObject(object);
+    return linker.link(sink);
+}
+
+bool ArmToHack::compileFile(const string& in_filename, const string& obj_filename) {
+    HackObject object;
+    if (!compileModule(in_filename, object))
+        return false;
+    return writeObject(object, obj_filename);
+}
+
+bool ArmToHack::compileModule(const string& in_filename, HackObject& object) {
+    if (!translateModule(in_filename))
+        return false;
+
+    module.options["inline_threshold"] = inline_threshold;
+    object = module;
+    return true;
+}
+
+bool ArmToHack::translateModule(const string& in_filename) {
     clearState();
     
-    input_stream.open(in_filename);
-    output_stream.open(out_filename);
+    if (!source_file.open(in_filename))
+        return false;
+
+    module.name = in_filename;
     
-    if (!input_stream.is_open() || !output_stream.is_open()) {
-        if (input_stream.is_open()) input_stream.close();
-        if (output_stream.is_open()) output_stream.close();
+    LineView line;
+    while (source_file.nextLine(line)) {
+        LineView rest = line;
+        if (takeToken(rest).size > 0) {
+            source_lines.push_back(line);
+        }
+    }
+
+    translateSource();
+    source_file.close();
+
+    auto calls = module.stats.find("inlined_calls");
+    if (calls != module.stats.end())
+        module.stats["inline_rom_growth"] += inlined_words - CALL_WORDS * calls->second;
+    return true;
+}
+
+// Translates source_lines into module. inlined_words counts the Hack words
+// emitted for lines copied from inlined function bodies.
+void ArmToHack::translateSource() {
+    rewriteSource();
+    analyzeStack();
+    buildFlowGraph();
+
+    for (current_line = 0; current_line < source_lines.size(); current_line++) {
+        size_t before = module.code.size();
+        translateLine(source_lines[current_line]);
+        if (current_line < inlined_lines.size() && inlined_lines[current_line])
+            inlined_words += module.code.size() - before;
+    }
+
+    source_lines.clear();
+    rewritten_text.clear();
+    inlined_lines.clear();
+    flow_graph.clear();
+
+    module.labels = label_map;
+    module.variables = variable_map;
+    for (const Relocation& reloc : module.relocations) {
+        if (reloc.kind == RELOC_SYMBOL && !module.defines(reloc.symbol))
+            module.imports.insert(reloc.symbol);
+    }
+}
+
+// Rewrites source_lines with the source-level passes applied: small leaf
+// functions expanded at their call sites, then loop optimization. The
+// rewritten lines live in rewritten_text.
+void ArmToHack::rewriteSource() {
+    std::vector<SourceLine> lines(source_lines.size());
+    for (size_t i = 0; i < source_lines.size(); i++) {
+        normalizeLine(source_lines[i], lines[i].text);
+        isLabelLine(source_lines[i], lines[i].label);
+        lines[i].inlined = i < inlined_lines.size() && inlined_lines[i];
+    }
+
+    bool changed = inlineLeafFunctions(lines);
+    changed = optimizeLoops(lines) || changed;
+    if (!changed)
         return;
+
+    source_lines.clear();
+    inlined_lines.clear();
+    for (const SourceLine& source_line : lines) {
+        rewritten_text.push_back(source_line.text);
+        source_lines.push_back(LineView{rewritten_text.back().data(), rewritten_text.back().size()});
+        inlined_lines.push_back(source_line.inlined);
     }
-    
-    initializeStack();
-    
-    string line;
-    while (input_stream) {
-        line = getNextLine(input_stream);
-        if (line.empty()) {
-            continue; 
-        }
-        
-        string first_token = getFirstToken(line);
-        string second_token = getSecondToken(line);
-        
-        bool is_instruction = (first_token == "MOV" || first_token == "ADD" || 
-                              first_token == "SUB" || first_token == "RSB" || 
-                              first_token == "CMP" || first_token == "END" ||
-                              first_token == "LDR" || first_token == "STR" ||
-                              first_token == "DCD" || first_token == "ASR" ||
-                              jump_map.find(first_token) != jump_map.end());
-        
-        if (second_token == "DCD") {
-            processData(line);
-            continue;
-        }
- 
-        if ((second_token.empty() || second_token[0] == ';') && !is_instruction) {
-            label_map[first_token] = line_number;
-            continue;
+}
+
+bool ArmToHack::inlineLeafFunctions(std::vector<SourceLine>& lines) {
+    LeafInliner inliner(inline_threshold);
+    if (!inliner.run(lines))
+        return false;
+
+    module.stats["inlined_calls"] = inliner.inlinedCalls();
+    if (inliner.removedFunctions() > 0)
+        module.stats["inlined_functions_removed"] = inliner.removedFunctions();
+    for (const vector<SourceLine>& function : inliner.removedCopies())
+        module.stats["inline_rom_growth"] -= outOfLineSize(function);
+    return true;
+}
+
+// Hack words a dropped out-of-line copy took, translated on its own. Lines
+// it got from earlier inlining are left out; they are counted at the call
+// sites they were copied to.
+int ArmToHack::outOfLineSize(const vector<SourceLine>& function) const {
+    ArmToHack translator;
+    for (const SourceLine& line : function) {
+        translator.rewritten_text.push_back(line.text);
+        const string& text = translator.rewritten_text.back();
+        translator.source_lines.push_back(LineView{text.data(), text.size()});
+        translator.inlined_lines.push_back(line.inlined);
+    }
+    translator.setInlineThreshold(0);
+    translator.translateSource();
+    return (int)translator.module.code.size() - translator.inlined_words;
+}
+
+bool ArmToHack::optimizeLoops(std::vector<SourceLine>& lines) {
+    LoopOptimizer optimizer(register_map);
+    bool changed = optimizer.run(lines);
+
+    if (optimizer.countedLoops() > 0)
+        module.stats["counted_loops_(report_only)"] = optimizer.countedLoops();
+    if (optimizer.hoistedInstructions() > 0)
+        module.stats["hoisted_instructions"] = optimizer.hoistedInstructions();
+    if (optimizer.reducedAccesses() > 0)
+        module.stats["strength_reduced_accesses"] = optimizer.reducedAccesses();
+    return changed;
+}
+
+void ArmToHack::buildFlowGraph() {
+    flow_graph.clear();
+    for (const LineView& source_line : source_lines) {
+        std::string label;
+        normalizeLine(source_line, line_buffer);
+        if (getSecondToken(line_buffer) == "DCD") {
+            flow_graph.addData();
+        } else if (isLabelLine(source_line, label)) {
+            flow_graph.addLabel(label);
+        } else {
+            flow_graph.addInstruction(line_buffer);
         }
-        
-        processInstruction(line);
+    }
+    flow_graph.computeLiveness();
+}
+
+// An instruction without side effects whose results, including the value
+// it leaves in D for a following branch, are all dead.
+bool ArmToHack::isDeadInstruction() const {
+    if (current_line >= flow_graph.size())
+        return false;
+
+    const ArmInstruction& instruction = flow_graph.at(current_line);
+    const std::string& op = instruction.opcode;
+    bool pure = (op == "MOV" || op == "ADD" || op == "SUB" || op == "RSB" ||
+                 op == "CMP" || op == "LDR");
+    return pure && instruction.defs != 0 && (instruction.defs & flow_graph.liveOut(current_line)) == 0;
+}
+
+bool ArmToHack::isLabelLine(LineView line, string& label) {
+    LineView first_token = takeToken(line);
+    LineView second_token = takeToken(line);
+
+    if (first_token.size == 0 || second_token.size > 0)
+        return false;
+
+    string name = toString(first_token);
+    bool is_instruction = (name == "MOV" || name == "ADD" || 
+                          name == "SUB" || name == "RSB" || 
+                          name == "CMP" || name == "END" ||
+                          name == "LDR" || name == "STR" ||
+                          name == "DCD" || name == "ASR" ||
+                          jump_map.find(name) != jump_map.end());
+
+    if (!is_instruction) {
+        label = name;
+        return true;
+    }
+    return false;
+}
+
+void ArmToHack::translateLine(LineView line) {
+    LineView rest = line;
+    takeToken(rest);
+    if (tokenEquals(takeToken(rest), "DCD")) {
+        normalizeLine(line, line_buffer);
+        processData(line_buffer);
+        return;
+    }
+
+    string label;
+    if (isLabelLine(line, label)) {
+        label_map[label] = line_number;
+        invalidateTracking();
+        return;
     }
     
-    input_stream.close();
-    output_stream.close();
+    if (isDeadInstruction()) {
+        module.stats["dead_instructions"]++;
+        return;
+    }
+
+    normalizeLine(line, line_buffer);
+    processInstruction(line_buffer);
 }
 
 void ArmToHack::processInstruction(const string& line) {
@@ -122,6 +464,9 @@ void ArmToHack::processInstruction(const string& line) {
         processData(line);
     } else if (instruction == "ASR") {
         processArithmeticShift(line);
+    } else if (instruction == "EXPORT" || instruction == "GLOBAL" ||
+               instruction == "IMPORT" || instruction == "EXTERN") {
+        processSymbolDirective(line);
     }
 }
 
@@ -133,9 +478,7 @@ void ArmToHack::processMove(std::string line) {
     evaluateOperand(op);
 
     if (register_map.find(dest) != register_map.end()) {
-        int dest_addr = register_map[dest];
-        emitLine("@" + to_string(dest_addr));
-        emitLine("M=D");
+        storeResult(register_map[dest]);
     }
     
     handleProgramCounter(dest);
@@ -147,32 +490,59 @@ void ArmToHack::processArithmeticOp(std::string line, int opType) {
     string op1 = takeToken(line);
     string op2 = takeToken(line);
 
-    evaluateOperand(op1);
-    emitLine("@16");
-    emitLine("M=D");
-
-    evaluateOperand(op2);
+    if (op1 == dest && updateInPlace(dest, op2, opType == 0 ? '+' : '-'))
+        return;
 
-    if (opType == 0) {
-        emitLine("@16");
-        emitLine("D=D+M");
-    } else if (opType == 1) {
-        emitLine("@16");
-        emitLine("D=M-D");
-    } else {
-        emitLine("@16");
-        emitLine("D=M-D");
-    }
+    evaluateOperand(op1);
+    applyOperand(op2, opType == 0 ? '+' : '-');
 
     if (register_map.find(dest) != register_map.end()) {
-        int dest_addr = register_map[dest];
-        emitLine("@" + to_string(dest_addr));
-        emitLine("M=D");
+        storeResult(register_map[dest]);
     }
     
     handleProgramCounter(dest);
 }
 
+// Rd = Rd op operand computed on the register cell itself, e.g. a loop
+// counter decrement becomes @Rd / MD=M-1 and leaves the result in D for a
+// following compare. Only used when Rd is live and not already in D.
+bool ArmToHack::updateInPlace(const string& dest, const string& operand, char op) {
+    auto reg = register_map.find(dest);
+    if (reg == register_map.end() || reg->second == register_map["PC"])
+        return false;
+
+    int addr = reg->second;
+    if (d_cells.count(cellName(addr)) || !flow_graph.isLiveAfter(current_line, addr))
+        return false;
+
+    int value = 0;
+    if (parseImmediate(operand, value)) {
+        if (op == 'r' || value == 0)
+            return false;
+        if (op == '-')
+            value = -value;
+        if (std::abs(value) != 1) {
+            emitLine("@" + to_string(std::abs(value)));
+            emitLine("D=A");
+        }
+        emitAddress(addr);
+        if (std::abs(value) == 1)
+            emitLine(value > 0 ? "MD=M+1" : "MD=M-1");
+        else
+            emitLine(value > 0 ? "MD=D+M" : "MD=M-D");
+        return true;
+    }
+
+    auto source = register_map.find(operand);
+    if (source == register_map.end() || source->second == addr)
+        return false;
+
+    loadRegister(source->second);
+    emitAddress(addr);
+    emitLine(op == '+' ? "MD=D+M" : op == '-' ? "MD=M-D" : "MD=D-M");
+    return true;
+}
+
 void ArmToHack::processAdd(std::string line) {
     processArithmeticOp(line, 0);
 }
@@ -187,19 +557,14 @@ void ArmToHack::processReverseSubtract(std::string line) {
     string op1 = takeToken(line);
     string op2 = takeToken(line);
 
-    evaluateOperand(op2);
-    emitLine("@16");
-    emitLine("M=D");
+    if (op1 == dest && updateInPlace(dest, op2, 'r'))
+        return;
 
     evaluateOperand(op1);
-
-    emitLine("@16");
-    emitLine("D=M-D");
+    applyOperand(op2, 'r');
 
     if (register_map.find(dest) != register_map.end()) {
-        int dest_addr = register_map[dest];
-        emitLine("@" + to_string(dest_addr));
-        emitLine("M=D");
+        storeResult(register_map[dest]);
     }
     
     handleProgramCounter(dest);
@@ -211,47 +576,85 @@ void ArmToHack::processCompare(std::string line) {
     string op2 = takeToken(line);
 
     evaluateOperand(op1);
-    emitLine("@16");
-    emitLine("M=D");
+    applyOperand(op2, '-');
 
-    evaluateOperand(op2);
-
-    emitLine("@16");
-    emitLine("D=M-D");
+    if (flow_graph.liveOut(current_line) & FLAG_CELL) {
+        emitScratchReference(SCRATCH_FLAGS);
+        emitLine("M=D");
+        module.stats["flag_cell_stores"]++;
+    }
 }
 
 void ArmToHack::processEnd(const string& line) {
     int jump_target = line_number + 1; 
-    emitLine("@" + to_string(jump_target));
+    emitRomReference(jump_target);
     emitLine("0;JMP");
 }
 
+bool ArmToHack::parseImmediate(const string& token, int& value) {
+    if (token.size() < 2 || token[0] != '#')
+        return false;
+
+    string num_str = token.substr(1); 
+
+    if (num_str[0] == '+') {
+        num_str = num_str.substr(1);
+    }
+
+    value = stoi(num_str);
+    return true;
+}
+
 void ArmToHack::evaluateOperand(const string& token) {
     if (register_map.find(token) != register_map.end()) {
-        int addr = register_map[token];
-        emitLine("@" + to_string(addr));
-        emitLine("D=M");
+        loadRegister(register_map[token]);
         return;
     }
 
-    if (token.size() > 1 && token[0] == '#') {
-        string num_str = token.substr(1); 
+    int value = 0;
+    if (parseImmediate(token, value))
+        loadConstant(value);
+}
 
-        if (num_str[0] == '+') {
-            num_str = num_str.substr(1);
+// Combines the second operand with the first one already in D, without
+// spilling D: '+' gives D+op, '-' gives D-op and 'r' gives op-D.
+void ArmToHack::applyOperand(const string& token, char op) {
+    if (register_map.find(token) != register_map.end()) {
+        int addr = register_map[token];
+        if (op != '+' && d_cells.count(cellName(addr))) {
+            emitLine("D=0");
+            return;
         }
+        emitAddress(addr);
+        emitLine(op == '+' ? "D=D+M" : op == '-' ? "D=D-M" : "D=M-D");
+        return;
+    }
 
-        int value = stoi(num_str);
+    int value = 0;
+    if (!parseImmediate(token, value))
+        return;
 
-        if (value < 0) {
-            emitLine("@" + to_string(-value));  
-            emitLine("D=A");
+    if (op != 'r' && value < 0) {
+        op = (op == '+') ? '-' : '+';
+        value = -value;
+    }
+
+    if (op == 'r') {
+        if (value == 0) {
             emitLine("D=-D");
-        } else {
+        } else if (value > 0) {
             emitLine("@" + to_string(value));
-            emitLine("D=A");
+            emitLine("D=A-D");
+        } else {
+            emitLine("@" + to_string(-value));
+            emitLine("D=D+A");
+            emitLine("D=-D");
         }
-        return;
+    } else if (value == 1) {
+        emitLine(op == '+' ? "D=D+1" : "D=D-1");
+    } else if (value != 0) {
+        emitLine("@" + to_string(value));
+        emitLine(op == '+' ? "D=D+A" : "D=D-A");
     }
 }
 
@@ -268,22 +671,14 @@ void ArmToHack::processBranch(std::string line) {
     string label = takeToken(line);
     
     if (instruction == "BL") {
-        int return_address = line_number + 6;
-        emitLine("@" + to_string(return_address));
+        int return_address = line_number + CALL_WORDS;
+        emitRomReference(return_address);
         emitLine("D=A");
         emitLine("@R14"); 
         emitLine("M=D");
         
-        if (label_map.find(label) != label_map.end()) {
-            int target_line = label_map[label];
-            emitLine("@" + to_string(target_line));
-            emitLine("0;JMP");
-        } else {
-            int current_line = line_number; 
-            emitLine("@-1");
-            hack_line_to_label_map[current_line] = label;  
-            emitLine("0;JMP");
-        }
+        emitSymbolReference(label);
+        emitLine("0;JMP");
         return;
     }
     
@@ -292,36 +687,26 @@ void ArmToHack::processBranch(std::string line) {
     }
     
     string hack_jump = jump_map[instruction];
-    
-    if (label_map.find(label) != label_map.end()) {
-        int target_line = label_map[label];
-        emitLine("@" + to_string(target_line));
-        if (instruction == "BAL") {
-            emitLine("0;JMP");
+
+    // A branch fused with its CMP tests the difference still in D; any
+    // other branch reads it back from the flag cell.
+    if (instruction != "BAL") {
+        if (current_line < flow_graph.size() && flow_graph.at(current_line).fused) {
+            module.stats["fused_compare_branches"]++;
         } else {
-            emitLine("D;" + hack_jump);
+            emitScratchReference(SCRATCH_FLAGS);
+            emitLine("D=M");
         }
+    }
+    
+    emitSymbolReference(label);
+    if (instruction == "BAL") {
+        emitLine("0;JMP");
     } else {
-        int current_line = line_number;  
-        emitLine("@-1");
-        hack_line_to_label_map[current_line] = label;  
-        
-        if (instruction == "BAL") {
-            emitLine("0;JMP");
-        } else {
-            emitLine("D;" + hack_jump);
-        }
+        emitLine("D;" + hack_jump);
     }
 }
 
-void ArmToHack::initializeStack() {
-    const int STACK_START = 16380;   
-    emitLine("@" + std::to_string(STACK_START));
-    emitLine("D=A");
-    emitLine("@13");  
-    emitLine("M=D");
-}
-
 void ArmToHack::processStoreMultiple(std::string line) {
     takeToken(line);
     std::string rn = takeToken(line); 
@@ -333,31 +718,18 @@ void ArmToHack::processStoreMultiple(std::string line) {
 
     int rn_addr = register_map[rn];
    
-    std::vector<int> regs;
-    std::string reg = takeToken(line);
-    while (!reg.empty()) {
-        removeChars(reg, "{}");
-        if (!reg.empty() && register_map.find(reg) != register_map.end()) {
-            regs.push_back(register_map[reg]);
-        }
-        if (reg.find('}') != std::string::npos || line.empty())
-            break;
-        reg = takeToken(line);
-    }
+    std::vector<int> regs = parseRegisterList(line);
 
     for (int r_addr : regs) {
-        emitLine("@" + std::to_string(r_addr));
-        emitLine("D=M");
-        emitLine("@" + std::to_string(rn_addr));
+        loadRegister(r_addr);
+        emitAddress(rn_addr);
         emitLine("A=M");
         emitLine("M=D");
 
-        emitLine("@" + std::to_string(rn_addr));
-        emitLine("D=M");
+        loadRegister(rn_addr);
         emitLine("@1");
         emitLine("D=D-A");
-        emitLine("@" + std::to_string(rn_addr));
-        emitLine("M=D");
+        storeRegister(rn_addr);
     }
 }
 
@@ -375,103 +747,94 @@ void ArmToHack::processLoadMultiple(std::string line) {
 
     int rn_addr = register_map[rn];
     
-    std::vector<int> regs;
-    std::string reg = takeToken(line);
-    while (!reg.empty()) {
-        removeChars(reg, "{}");
-        if (!reg.empty() && register_map.find(reg) != register_map.end()) {
-            regs.push_back(register_map[reg]);
-        }
-        if (reg.find('}') != std::string::npos || line.empty())
-            break;
-        reg = takeToken(line);
-    }
+    std::vector<int> regs = parseRegisterList(line);
 
     for (size_t i = 0; i < regs.size(); ++i) {
         int r_addr = regs[i];
         int offset = i + 1; 
+        if (!flow_graph.isLiveAfter(current_line, r_addr)) {
+            module.stats["dead_register_stores"]++;
+            continue;
+        }
 
-        emitLine("@" + std::to_string(rn_addr));
-        emitLine("D=M");
+        loadRegister(rn_addr);
         emitLine("@" + std::to_string(offset));
         emitLine("D=D+A");
 
         emitLine("A=D");
         emitLine("D=M");
-        emitLine("@" + std::to_string(r_addr));
-        emitLine("M=D");
+        storeRegister(r_addr);
     }
 
     if (write_back) {
-        emitLine("@" + std::to_string(rn_addr));
-        emitLine("D=M");
+        loadRegister(rn_addr);
         emitLine("@" + std::to_string(regs.size()));
         emitLine("D=D+A");
-        emitLine("@" + std::to_string(rn_addr));
-        emitLine("M=D");
+        storeResult(rn_addr);
     }
 }
 
-void ArmToHack::computeAddressAndStore(std::string base, std::string offset, int srcAddr, bool isLoad, int destAddr) {
-    if (!register_map.count(base))
-        return;
-
-    int baseAddr = register_map[base];
+bool ArmToHack::isValidMemoryOperand(const MemoryOperand& operand) {
+    return register_map.count(operand.base) && (operand.index.empty() || register_map.count(operand.index));
+}
 
-    if (offset == "LSL") {
-        offset = base;
+// Leaves the scaled index register in D, doubling it once per shift step.
+void ArmToHack::loadIndex(const MemoryOperand& operand) {
+    loadRegister(register_map[operand.index]);
+    for (int i = 0; i < operand.shift; i++) {
+        emitLine("A=D");
+        emitLine("D=D+A");
     }
+}
 
-    if (offset.empty() || offset[0] == '#' || offset[0] == '+' || offset[0] == '-') {
-        if (offset.empty()) offset = "#0";
-
-        removeChars(offset, "#+ ");
-        int imm = 0;
-        if (!offset.empty()) {
-            imm = (offset[0] == '-') ? -stoi(offset.substr(1)) : stoi(offset);
-        }
-
-        emitLine("@" + std::to_string(baseAddr));
-        emitLine("D=M");
-
-        if (imm != 0) {
-            emitLine("@" + std::to_string(std::abs(imm)));
-            emitLine(imm > 0 ? "D=D+A" : "D=D-A");
-        }
-
-        emitLine("@15");
-        emitLine("M=D");
-    }
-    else if (register_map.count(offset)) {
-        int idxAddr = register_map[offset];
-        emitLine("@" + std::to_string(baseAddr));
-        emitLine("D=M");
-        emitLine("@" + std::to_string(idxAddr));
-        emitLine("D=D+M");
-        emitLine("@15");
-        emitLine("M=D");
+// Leaves the pre-indexed address base + offset in D.
+void ArmToHack::computeAddress(const MemoryOperand& operand) {
+    int base_addr = register_map[operand.base];
+    if (operand.index.empty()) {
+        loadRegister(base_addr);
+        applyOperand("#" + std::to_string(operand.offset), '+');
+    } else if (operand.shift == 0) {
+        loadRegister(base_addr);
+        applyOperand(operand.index, operand.subtract ? '-' : '+');
     } else {
-        emitLine("@" + std::to_string(baseAddr));
-        emitLine("D=M");
-        emitLine("@15");
-        emitLine("M=D");
+        loadIndex(operand);
+        emitAddress(base_addr);
+        emitLine(operand.subtract ? "D=M-D" : "D=D+M");
     }
+}
 
-    if (isLoad) {
-        emitLine("@15");
-        emitLine("A=M");
-        emitLine("D=M");
-        if (destAddr != -1) {
-            emitLine("@" + std::to_string(destAddr));
-            emitLine("M=D");
+// Adds the offset to the base register in place.
+void ArmToHack::bumpRegister(const MemoryOperand& operand) {
+    int base_addr = register_map[operand.base];
+    if (operand.index.empty()) {
+        int amount = std::abs(operand.offset);
+        if (amount == 0)
+            return;
+        if (amount != 1) {
+            emitLine("@" + std::to_string(amount));
+            emitLine("D=A");
         }
-    } else {
-        emitLine("@" + std::to_string(srcAddr));
-        emitLine("D=M");
-        emitLine("@15");
-        emitLine("A=M");
-        emitLine("M=D");
+        emitAddress(base_addr);
+        if (amount == 1)
+            emitLine(operand.offset > 0 ? "M=M+1" : "M=M-1");
+        else
+            emitLine(operand.offset > 0 ? "M=D+M" : "M=M-D");
+        return;
     }
+
+    loadIndex(operand);
+    emitAddress(base_addr);
+    emitLine(operand.subtract ? "M=M-D" : "M=D+M");
+}
+
+// Whether the base register update of a writeback form is needed at all.
+bool ArmToHack::needsWriteback(const MemoryOperand& operand) {
+    if (!operand.writeback)
+        return false;
+    if (flow_graph.isLiveAfter(current_line, register_map[operand.base]))
+        return true;
+    module.stats["dead_register_stores"]++;
+    return false;
 }
 
 void ArmToHack::processLoad(std::string line) {
@@ -485,26 +848,43 @@ void ArmToHack::processLoad(std::string line) {
         std::string label = operand.substr(1);
         removeChars(label, " ");
 
-        auto it = variable_map.find(label);
-        if (it != variable_map.end()) {
-            emitLine("@" + std::to_string(it->second));
-            emitLine("D=A");
+        emitSymbolReference(label);
+        emitLine("D=A");
 
-            if (register_map.count(rd)) {
-                emitLine("@" + std::to_string(register_map[rd]));
-                emitLine("M=D");
-            }
-            handleProgramCounter(rd);
+        if (register_map.count(rd)) {
+            storeResult(register_map[rd]);
         }
+        handleProgramCounter(rd);
         return;
     }
 
-    removeChars(operand, "[] ");
-    std::string base = takeToken(operand);
-    std::string offset = takeToken(operand);
+    MemoryOperand address = parseMemoryOperand(operand);
+    if (!isValidMemoryOperand(address))
+        return;
 
-    int destAddr = register_map.count(rd) ? register_map[rd] : -1;
-    computeAddressAndStore(base, offset, -1, true, destAddr);
+    int base_addr = register_map[address.base];
+    bool writeback = needsWriteback(address);
+    bool near_base = address.index.empty() && std::abs(address.offset) <= 1;
+
+    if (writeback && !address.post_index) {
+        bumpRegister(address);
+        emitAddress(base_addr);
+        emitLine("A=M");
+    } else if (address.post_index || near_base) {
+        emitAddress(base_addr);
+        emitLine(address.post_index || address.offset == 0 ? "A=M" : address.offset > 0 ? "A=M+1" : "A=M-1");
+    } else {
+        computeAddress(address);
+        emitLine("A=D");
+    }
+    emitLine("D=M");
+
+    if (register_map.count(rd)) {
+        storeResult(register_map[rd]);
+    }
+
+    if (writeback && address.post_index)
+        bumpRegister(address);
 
     handleProgramCounter(rd);
 }
@@ -517,19 +897,38 @@ void ArmToHack::processStore(std::string line) {
         return;
     
     int source_register_addr = register_map[source_register];
-    
-    removeChars(line, " ");
-    std::string address_expression = line;
-    removeChars(address_expression, "[] ");
-    
-    std::string base_register_name = takeToken(address_expression);
-    std::string index_expression = takeToken(address_expression);
-    
-    if (index_expression == "LSL") {
-        index_expression = base_register_name;
+
+    MemoryOperand address = parseMemoryOperand(line);
+    if (!isValidMemoryOperand(address))
+        return;
+
+    int base_addr = register_map[address.base];
+    bool writeback = needsWriteback(address);
+    bool near_base = address.index.empty() && std::abs(address.offset) <= 1;
+
+    // With writeback the base register itself ends up holding the address,
+    // so no scratch cell is needed.
+    if (writeback && !address.post_index)
+        bumpRegister(address);
+
+    if (writeback || address.post_index || near_base) {
+        bool at_base = writeback || address.post_index || address.offset == 0;
+        loadRegister(source_register_addr);
+        emitAddress(base_addr);
+        emitLine(at_base ? "A=M" : address.offset > 0 ? "A=M+1" : "A=M-1");
+        emitLine("M=D");
+    } else {
+        computeAddress(address);
+        emitScratchReference(SCRATCH_ADDRESS);
+        emitLine("M=D");
+        loadRegister(source_register_addr);
+        emitScratchReference(SCRATCH_ADDRESS);
+        emitLine("A=M");
+        emitLine("M=D");
     }
-    
-    computeAddressAndStore(base_register_name, index_expression, source_register_addr, false, -1);
+
+    if (writeback && address.post_index)
+        bumpRegister(address);
 }
 
 void ArmToHack::processData(std::string line) {
@@ -539,8 +938,8 @@ void ArmToHack::processData(std::string line) {
     
     takeToken(line);
     
-    int start_addr = current_memory_location;
-    variable_map[var_name] = start_addr;
+    int start_offset = module.data.size();
+    variable_map[var_name] = start_offset;
     
     std::string value_token = takeToken(line);
     
@@ -570,19 +969,7 @@ void ArmToHack::processData(std::string line) {
             }
         }
         
-        if (value < 0) {
-            emitLine("@" + std::to_string(-value));
-            emitLine("D=A");
-            emitLine("D=-D");
-        } else {
-            emitLine("@" + std::to_string(value));
-            emitLine("D=A");
-        }
-        
-        emitLine("@" + std::to_string(current_memory_location));
-        emitLine("M=D");
-        
-        current_memory_location++;
+        module.data.push_back(value);
         
         value_token = takeToken(line);
     }
@@ -604,9 +991,8 @@ void ArmToHack::processArithmeticShift(std::string line) {
     int src_addr  = register_map[srcReg];
     int sp_addr   = register_map["SP"];  
 
-    emitLine("@" + std::to_string(src_addr));
-    emitLine("D=M");                 
-    emitLine("@" + std::to_string(sp_addr));
+    loadRegister(src_addr);
+    emitAddress(sp_addr);
     emitLine("A=M");                
     emitLine("M=D");                
 
@@ -618,6 +1004,7 @@ void ArmToHack::processArithmeticShift(std::string line) {
     emitLine("M=0");                
     
     int loop_start = line_number;      
+    invalidateTracking();
 
     emitLine("@" + std::to_string(sp_addr));
     emitLine("A=M");                 
@@ -625,10 +1012,8 @@ void ArmToHack::processArithmeticShift(std::string line) {
     emitLine("@2");
     emitLine("D=D-A");             
 
-    int unresolved_line = line_number; 
-    emitLine("@-1");
-    std::string end_label = "ASR_END_" + std::to_string(unresolved_line);
-    hack_line_to_label_map[unresolved_line] = end_label;
+    std::string end_label = "ASR_END_" + std::to_string(line_number);
+    emitSymbolReference(end_label);
     emitLine("D;JLT");              
 
     emitLine("@" + std::to_string(sp_addr));
@@ -642,10 +1027,11 @@ void ArmToHack::processArithmeticShift(std::string line) {
     emitLine("A=D");
     emitLine("M=M+1");               
 
-    emitLine("@" + std::to_string(loop_start));
+    emitRomReference(loop_start);
     emitLine("0;JMP");
 
     label_map[end_label] = line_number;
+    invalidateTracking();
 
     emitLine("@" + std::to_string(sp_addr));
     emitLine("D=M");                
@@ -654,46 +1040,174 @@ void ArmToHack::processArithmeticShift(std::string line) {
     emitLine("A=D");
     emitLine("D=M");               
 
-    emitLine("@" + std::to_string(dest_addr));
-    emitLine("M=D");
+    storeResult(dest_addr);
 
     handleProgramCounter(destReg);
 }
 
-void ArmToHack::secondPass(const string& in_filename, const string& out_filename) {
-    ifstream input_file;
-    output_stream.open(out_filename); 
-    
-    line_number = 0;
-    
-    input_file.open(in_filename);
-    
-    if (!input_file.is_open() || !output_stream.is_open()) {
-        if (input_file.is_open()) input_file.close();
-        if (output_stream.is_open()) output_stream.close();
-        return;
+void ArmToHack::processSymbolDirective(std::string line) {
+    std::string directive = takeToken(line);
+    bool is_export = (directive == "EXPORT" || directive == "GLOBAL");
+
+    std::string symbol = takeToken(line);
+    while (!symbol.empty()) {
+        if (is_export) {
+            module.exports.insert(symbol);
+        } else {
+            module.imports.insert(symbol);
+        }
+        symbol = takeToken(line);
     }
-    
-    int current_line = 0;
-    string line;
-    
-    while (getline(input_file, line)) {
-        if (hack_line_to_label_map.find(current_line) != hack_line_to_label_map.end()) {
-            string label = hack_line_to_label_map[current_line];
-            
-            if (label_map.find(label) != label_map.end()) {
-                int target_line = label_map[label];
-                emitLine("@" + to_string(target_line));
-            } else {
-                emitLine("@-1");
+}
+
+std::vector<int> ArmToHack::parseRegisterList(std::string& line) {
+    std::vector<int> regs;
+    std::string reg = takeToken(line);
+    while (!reg.empty()) {
+        removeChars(reg, "{}");
+        if (!reg.empty() && register_map.find(reg) != register_map.end()) {
+            regs.push_back(register_map[reg]);
+        }
+        if (reg.find('}') != std::string::npos || line.empty())
+            break;
+        reg = takeToken(line);
+    }
+    return regs;
+}
+
+void ArmToHack::analyzeStack() {
+    std::map<std::string, size_t> label_lines;
+    std::set<std::string> entries;
+
+    for (size_t i = 0; i < source_lines.size(); i++) {
+        std::string label;
+        LineView rest = source_lines[i];
+        if (isLabelLine(source_lines[i], label)) {
+            label_lines[label] = i;
+            continue;
+        }
+
+        // BL targets and exported labels can be entered with their own
+        // stack frame, the latter from other modules.
+        LineView opcode = takeToken(rest);
+        if (tokenEquals(opcode, "BL")) {
+            entries.insert(toString(takeToken(rest)));
+        } else if (tokenEquals(opcode, "EXPORT") || tokenEquals(opcode, "GLOBAL")) {
+            for (LineView symbol = takeToken(rest); symbol.size > 0; symbol = takeToken(rest))
+                entries.insert(toString(symbol));
+        }
+    }
+
+    module.frames.push_back(traceFrame(MODULE_ENTRY, 0, label_lines));
+    for (const std::string& name : entries) {
+        auto entry = label_lines.find(name);
+        if (entry != label_lines.end())
+            module.frames.push_back(traceFrame(name, entry->second, label_lines));
+    }
+}
+
+// Follows every path from an entry line, tracking how many words the code
+// has pushed below the entry stack pointer. STMDA/LDMIB with writeback,
+// LDR/STR writeback on SP and ADD/SUB SP, SP, #imm move SP; ASR borrows the
+// two cells at and below SP. Paths end at END or at a write to PC.
+StackFrame ArmToHack::traceFrame(const std::string& entry, size_t start,
+                                 const std::map<std::string, size_t>& label_lines) {
+    StackFrame frame;
+    frame.entry = entry;
+    frame.depth = 0;
+
+    const int sp = register_map["SP"];
+    const int pc = register_map["PC"];
+    std::map<size_t, int> seen;
+    std::vector<std::pair<size_t, int>> pending;
+    std::string line;
+    pending.push_back(std::make_pair(start, 0));
+
+    while (!pending.empty()) {
+        size_t i = pending.back().first;
+        int depth = pending.back().second;
+        pending.pop_back();
+
+        while (i < source_lines.size()) {
+            auto visited = seen.find(i);
+            if (visited != seen.end()) {
+                if (visited->second != depth) {
+                    frame.depth = -1;
+                    return frame;
+                }
+                break;
             }
-        } else {
-            emitLine(line);
+            seen[i] = depth;
+
+            normalizeLine(source_lines[i], line);
+            std::string label;
+            if (getSecondToken(line) == "DCD" || isLabelLine(source_lines[i], label)) {
+                i++;
+                continue;
+            }
+
+            std::string instruction = takeToken(line);
+            std::string dest = takeToken(line);
+            bool writeback = !dest.empty() && dest.back() == '!';
+            if (writeback)
+                dest.pop_back();
+            int dest_addr = register_map.count(dest) ? register_map[dest] : -1;
+
+            if (instruction == "END" || dest_addr == pc)
+                break;
+
+            if (instruction == "STMDA" && dest_addr == sp) {
+                int count = parseRegisterList(line).size();
+                frame.depth = std::max(frame.depth, depth + count);
+                if (writeback)
+                    depth += count;
+            } else if (instruction == "LDMIB" && dest_addr == sp) {
+                if (writeback)
+                    depth -= parseRegisterList(line).size();
+            } else if (instruction == "ASR") {
+                frame.depth = std::max(frame.depth, depth + 2);
+            } else if (dest_addr == sp && instruction != "STR" && instruction != "CMP" &&
+                       instruction != "STMDA" && instruction != "LDMIB") {
+                std::string op1 = takeToken(line);
+                std::string op2 = takeToken(line);
+                if ((instruction != "ADD" && instruction != "SUB") || op1 != dest ||
+                    op2.size() < 2 || op2[0] != '#') {
+                    frame.depth = -1;
+                    return frame;
+                }
+                int amount = stoi(op2.substr(1));
+                depth += (instruction == "SUB") ? amount : -amount;
+                frame.depth = std::max(frame.depth, depth);
+            } else if ((instruction == "LDR" || instruction == "STR") && !line.empty() && line[0] == '[') {
+                MemoryOperand address = parseMemoryOperand(line);
+                if (address.writeback && register_map.count(address.base) && register_map[address.base] == sp) {
+                    if (!address.index.empty()) {
+                        frame.depth = -1;
+                        return frame;
+                    }
+                    int accessed = address.post_index ? depth : depth - address.offset;
+                    depth -= address.offset;
+                    frame.depth = std::max(frame.depth, std::max(accessed + 1, depth));
+                }
+            } else if (instruction == "BL") {
+                auto call = frame.calls.find(dest);
+                if (call == frame.calls.end() || call->second < depth)
+                    frame.calls[dest] = depth;
+            } else if (jump_map.count(instruction)) {
+                auto target = label_lines.find(dest);
+                if (instruction == "BAL") {
+                    if (target == label_lines.end())
+                        break;
+                    i = target->second;
+                    continue;
+                }
+                if (target != label_lines.end())
+                    pending.push_back(std::make_pair(target->second, depth));
+            }
+
+            i++;
         }
-        
-        current_line++;
     }
-    
-    input_file.close();
-    output_stream.close();  
+
+    return frame;
 }
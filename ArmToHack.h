@@ -3,34 +3,88 @@
 
 #include <string>
 #include <map>
+#include <vector>
+#include <set>
+#include <deque>
 #include <fstream>
 #include <sstream>
 #include "token_io.h"
+#include "HackObject.h"
+#include "OutputSink.h"
+#include "SourceFile.h"
+#include "FlowGraph.h"
+#include "LeafInliner.h"
+#include "LoopOptimizer.h"
 
 class ArmToHack {
 private:
-    std::ifstream input_stream;
-    std::ofstream output_stream;
+    SourceFile source_file;
+    HackObject module;
+    FileSink output_sink;
     int line_number;
     std::map<std::string, int> register_map;
     std::map<std::string, std::string> jump_map; 
     std::map<std::string, int> label_map;  
-    std::map<int, std::string> hack_line_to_label_map;
     std::map<std::string, int> variable_map; 
-    int current_memory_location;  
+    std::vector<LineView> source_lines;
+    std::deque<std::string> rewritten_text;
+    std::vector<char> inlined_lines;
+    int inlined_words;
+    int inline_threshold;
+    FlowGraph flow_graph;
+    size_t current_line;
+    std::string line_buffer;
+    std::string a_value;
+    std::string d_value;
+    std::set<std::string> d_cells;
+    bool parseImmediate(const std::string& token, int& value);
     void evaluateOperand(const std::string& token);
+    void applyOperand(const std::string& token, char op);
     void handleProgramCounter(const std::string& regRd);
     void processBranch(std::string line);
-    void secondPass(const std::string& in_filename, const std::string& out_filename);
+    void emitSymbolReference(const std::string& symbol);
+    void emitRomReference(int line);
+    void emitScratchReference(int slot);
+    void trackInstruction(const std::string& line);
+    void invalidateTracking();
+    std::string cellName(int addr) const;
+    void emitAddress(int addr);
+    void loadRegister(int addr);
+    void storeRegister(int addr);
+    void loadConstant(int value);
+    void storeResult(int addr);
+    void buildFlowGraph();
+    bool isDeadInstruction() const;
+    bool isLabelLine(LineView line, std::string& label);
+    bool translateModule(const std::string& in_filename);
+    void translateSource();
+    void rewriteSource();
+    bool inlineLeafFunctions(std::vector<SourceLine>& lines);
+    int outOfLineSize(const std::vector<SourceLine>& function) const;
+    bool optimizeLoops(std::vector<SourceLine>& lines);
+    void translateLine(LineView line);
+    std::vector<int> parseRegisterList(std::string& line);
+    void analyzeStack();
+    StackFrame traceFrame(const std::string& entry, size_t start, const std::map<std::string, size_t>& label_lines);
     void processArithmeticOp(std::string line, int opType);
-    void computeAddressAndStore(std::string base, std::string offset, int srcAddr, bool isLoad, int destAddr);
+    bool updateInPlace(const std::string& dest, const std::string& operand, char op);
+    bool isValidMemoryOperand(const MemoryOperand& operand);
+    void loadIndex(const MemoryOperand& operand);
+    void computeAddress(const MemoryOperand& operand);
+    void bumpRegister(const MemoryOperand& operand);
+    bool needsWriteback(const MemoryOperand& operand);
 
 public:
+    static const int DEFAULT_INLINE_THRESHOLD = 4;
+    static const int CALL_WORDS = 6;
     ArmToHack();
+    void setInlineThreshold(int max_instructions);
     void clearState();
     void emitLine(const std::string& line);
     void convertFile(const std::string& in_filename, const std::string& out_filename);
-    void firstPass(const std::string& in_filename, const std::string& out_filename);
+    bool convertFile(const std::string& in_filename, OutputSink& sink);
+    bool compileFile(const std::string& in_filename, const std::string& obj_filename);
+    bool compileModule(const std::string& in_filename, HackObject& object);
     void processInstruction(const std::string& line);
     void processMove(std::string line);
     void processAdd(std::string line);
@@ -44,7 +98,7 @@ public:
     void processStore(std::string line);
     void processData(std::string line);
     void processArithmeticShift(std::string line);
-    void initializeStack();
+    void processSymbolDirective(std::string line);
 };
 
 #endif
@@ -0,0 +1,247 @@
+#include "FlowGraph.h"
+#include "token_io.h"
+
+using namespace std;
+
+FlowGraph::FlowGraph(const map<string, int>& registers) : register_map(registers) {}
+
+void FlowGraph::clear() {
+    instructions.clear();
+    label_index.clear();
+    live_in.clear();
+    live_out.clear();
+}
+
+static ArmInstruction emptyNode() {
+    ArmInstruction node;
+    node.uses = 0;
+    node.defs = 0;
+    node.falls_through = true;
+    node.exits = false;
+    node.fused = false;
+    return node;
+}
+
+void FlowGraph::addLabel(const string& name) {
+    ArmInstruction node = emptyNode();
+    node.label = name;
+    label_index[name] = instructions.size();
+    instructions.push_back(node);
+}
+
+void FlowGraph::addData() {
+    instructions.push_back(emptyNode());
+}
+
+void FlowGraph::addInstruction(const string& line) {
+    ArmInstruction node = emptyNode();
+    string rest = line;
+    node.opcode = takeToken(rest);
+    string operand = takeToken(rest);
+    while (!operand.empty()) {
+        node.operands.push_back(operand);
+        operand = takeToken(rest);
+    }
+    decode(node);
+
+    if (node.uses & REGISTER_FLAGS) {
+        const ArmInstruction* previous = instructions.empty() ? nullptr : &instructions.back();
+        node.fused = previous && (previous->opcode == "CMP" || previous->fused);
+        if (!node.fused)
+            node.uses |= FLAG_CELL;
+    }
+    instructions.push_back(node);
+}
+
+void FlowGraph::build(const vector<SourceLine>& lines) {
+    clear();
+    for (const SourceLine& line : lines) {
+        if (!line.label.empty())
+            addLabel(line.label);
+        else if (getSecondToken(line.text) == "DCD")
+            addData();
+        else
+            addInstruction(line.text);
+    }
+    computeLiveness();
+}
+
+unsigned FlowGraph::registerBit(string token) const {
+    removeChars(token, "[]{}!");
+    auto reg = register_map.find(token);
+    return reg == register_map.end() ? 0 : 1u << reg->second;
+}
+
+unsigned FlowGraph::registersIn(size_t first, const ArmInstruction& instruction) const {
+    unsigned regs = 0;
+    for (size_t i = first; i < instruction.operands.size(); i++)
+        regs |= registerBit(instruction.operands[i]);
+    return regs;
+}
+
+// Registers read by the address operand of LDR/STR; written_back gets the
+// base register when the form writes it back.
+unsigned FlowGraph::addressRegisters(const ArmInstruction& node, unsigned& written_back) const {
+    written_back = 0;
+    string text;
+    for (size_t i = 1; i < node.operands.size(); i++)
+        text += (i > 1 ? " " : "") + node.operands[i];
+    if (text.empty() || text[0] != '[')
+        return 0;
+
+    MemoryOperand address = parseMemoryOperand(text);
+    unsigned base = registerBit(address.base);
+    if (address.writeback)
+        written_back = base;
+    return base | (address.index.empty() ? 0 : registerBit(address.index));
+}
+
+void FlowGraph::decode(ArmInstruction& node) {
+    const string& op = node.opcode;
+    const vector<string>& args = node.operands;
+    unsigned first = args.empty() ? 0 : registerBit(args[0]);
+    const unsigned pc = 1u << register_map.at("PC");
+    const unsigned sp = 1u << register_map.at("SP");
+    const unsigned lr = 1u << register_map.at("LR");
+
+    if (op == "MOV" || op == "ADD" || op == "SUB" || op == "RSB") {
+        node.defs = first;
+        node.uses = registersIn(1, node);
+    } else if (op == "CMP") {
+        node.defs = REGISTER_FLAGS | FLAG_CELL;
+        node.uses = registersIn(0, node);
+    } else if (op == "LDR" || op == "STR") {
+        unsigned written_back = 0;
+        node.uses = addressRegisters(node, written_back);
+        node.defs = written_back;
+        if (op == "LDR")
+            node.defs |= first;
+        else
+            node.uses |= first;
+    } else if (op == "STMDA" || op == "LDMIB") {
+        // STMDA walks its base register down even without writeback.
+        bool writeback = op == "STMDA" || (!args.empty() && args[0].back() == '!');
+        unsigned list = registersIn(1, node);
+        node.defs = (writeback ? first : 0) | (op == "LDMIB" ? list : 0);
+        node.uses = first | (op == "STMDA" ? list : 0);
+    } else if (op == "ASR") {
+        node.defs = first;
+        node.uses = registersIn(1, node) | sp;
+    } else if (op == "BL") {
+        node.defs = lr;
+        node.uses = ALL_REGISTERS;
+    } else if (op == "BAL") {
+        node.target = args.empty() ? "" : args[0];
+        node.falls_through = false;
+    } else if (op.size() == 3 && op[0] == 'B') {
+        node.target = args.empty() ? "" : args[0];
+        node.uses = REGISTER_FLAGS;
+    } else if (op == "END") {
+        node.uses = ALL_REGISTERS;
+        node.falls_through = false;
+    } else if (op != "EXPORT" && op != "GLOBAL" && op != "IMPORT" && op != "EXTERN" && op != "DCD") {
+        node.uses = LIVE_AT_EXIT;
+    }
+
+    if (node.defs & pc) {
+        node.uses |= ALL_REGISTERS;
+        node.falls_through = false;
+        node.exits = true;
+    }
+}
+
+vector<size_t> FlowGraph::successors(size_t i) const {
+    vector<size_t> next;
+    const ArmInstruction& node = instructions[i];
+    if (node.falls_through && i + 1 < instructions.size())
+        next.push_back(i + 1);
+    if (!node.target.empty()) {
+        auto target = label_index.find(node.target);
+        if (target != label_index.end())
+            next.push_back(target->second);
+    }
+    return next;
+}
+
+// The flag cell stays live through calls only where the module needs it:
+// returns keep it when a branch after some BL reads it, and BL reads it when
+// some function of the module branches on it before its own CMP. Callees
+// that do not pass flags back and callers that do not pass flags in pay
+// nothing.
+void FlowGraph::computeLiveness() {
+    size_t count = instructions.size();
+    live_in.assign(count, 0);
+    live_out.assign(count, 0);
+
+    unsigned live_at_return = ALL_REGISTERS;
+    unsigned read_by_call = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t n = count; n-- > 0;) {
+            const ArmInstruction& node = instructions[n];
+            unsigned out = 0;
+
+            bool leaves = (node.falls_through && n + 1 == count) ||
+                          (!node.target.empty() && !label_index.count(node.target));
+            if (node.exits)
+                out = live_at_return;
+            else if (leaves)
+                out = LIVE_AT_EXIT;
+            for (size_t next : successors(n))
+                out |= live_in[next];
+
+            unsigned in = node.uses | (out & ~node.defs);
+            if (node.opcode == "BL")
+                in |= read_by_call;
+            if (in != live_in[n] || out != live_out[n]) {
+                live_in[n] = in;
+                live_out[n] = out;
+                changed = true;
+            }
+        }
+
+        for (size_t n = 0; n < count && !changed; n++) {
+            const ArmInstruction& node = instructions[n];
+            if (node.opcode != "BL")
+                continue;
+            if ((live_out[n] & FLAG_CELL) && !(live_at_return & FLAG_CELL)) {
+                live_at_return |= FLAG_CELL;
+                changed = true;
+            }
+            auto callee = node.operands.empty() ? label_index.end() : label_index.find(node.operands[0]);
+            if (callee != label_index.end() && (live_in[callee->second] & FLAG_CELL) && !read_by_call) {
+                read_by_call = FLAG_CELL;
+                changed = true;
+            }
+        }
+    }
+}
+
+size_t FlowGraph::size() const {
+    return instructions.size();
+}
+
+const ArmInstruction& FlowGraph::at(size_t i) const {
+    return instructions[i];
+}
+
+unsigned FlowGraph::liveIn(size_t i) const {
+    return i < live_in.size() ? live_in[i] : LIVE_AT_EXIT;
+}
+
+unsigned FlowGraph::liveOut(size_t i) const {
+    return i < live_out.size() ? live_out[i] : LIVE_AT_EXIT;
+}
+
+bool FlowGraph::isLiveAfter(size_t i, int reg) const {
+    return (liveOut(i) & (1u << reg)) != 0;
+}
+
+bool FlowGraph::findLabel(const string& name, size_t& index) const {
+    auto label = label_index.find(name);
+    if (label == label_index.end())
+        return false;
+    index = label->second;
+    return true;
+}
@@ -0,0 +1,68 @@
+#ifndef FLOWGRAPH_H_
+#define FLOWGRAPH_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include "token_io.h"
+
+// Register sets are bit masks over R0-R15 and, above them, the loop pointer
+// cells. REGISTER_FLAGS stands for the condition flags set by CMP and
+// FLAG_CELL for their copy in the flag scratch cell, which is only read by
+// branches that do not directly follow their compare.
+const unsigned ALL_REGISTERS = 0xffff;
+const unsigned REGISTER_FLAGS = 1u << 24;
+const unsigned FLAG_CELL = 1u << 25;
+const unsigned LIVE_AT_EXIT = ALL_REGISTERS | REGISTER_FLAGS | FLAG_CELL;
+
+struct ArmInstruction {
+    std::string label;
+    std::string opcode;
+    std::vector<std::string> operands;
+    unsigned uses;
+    unsigned defs;
+    std::string target;
+    bool falls_through;
+    bool exits;
+    bool fused;
+};
+
+// Control flow graph of one ARM module at instruction granularity, with
+// backward register liveness. Labels and DCD lines are kept as empty nodes
+// so node indices match source line indices. BL is treated as reading every
+// register and returns as leaving every register live. The flags pass
+// through a call in the flag cell, which BL leaves alone, so a branch after
+// a call sees the same flags with and without inlining. Branches out of the
+// module and falling off its end keep the flags too.
+// A conditional branch is fused with its CMP when nothing but other fused
+// branches lies between them, so D still holds the comparison.
+class FlowGraph {
+private:
+    const std::map<std::string, int>& register_map;
+    std::vector<ArmInstruction> instructions;
+    std::map<std::string, size_t> label_index;
+    std::vector<unsigned> live_in;
+    std::vector<unsigned> live_out;
+    unsigned registerBit(std::string token) const;
+    unsigned registersIn(size_t first, const ArmInstruction& instruction) const;
+    unsigned addressRegisters(const ArmInstruction& instruction, unsigned& written_back) const;
+    void decode(ArmInstruction& instruction);
+
+public:
+    explicit FlowGraph(const std::map<std::string, int>& registers);
+    void clear();
+    void addLabel(const std::string& name);
+    void addData();
+    void addInstruction(const std::string& line);
+    void build(const std::vector<SourceLine>& lines);
+    void computeLiveness();
+    size_t size() const;
+    const ArmInstruction& at(size_t i) const;
+    std::vector<size_t> successors(size_t i) const;
+    unsigned liveIn(size_t i) const;
+    unsigned liveOut(size_t i) const;
+    bool isLiveAfter(size_t i, int reg) const;
+    bool findLabel(const std::string& name, size_t& index) const;
+};
+
+#endif
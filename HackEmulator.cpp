@@ -0,0 +1,171 @@
+#include "HackEmulator.h"
+#include "token_io.h"
+#include <map>
+#include <cctype>
+
+using namespace std;
+
+// ALU control bits zx nx zy ny f no of each computation, written with A;
+// the M forms use the same bits and read memory instead.
+static const map<string, int>& computations() {
+    static const map<string, int> table = {
+        {"0", 052}, {"1", 077}, {"-1", 072}, {"D", 014}, {"A", 060}, {"!D", 015},
+        {"!A", 061}, {"-D", 017}, {"-A", 063}, {"D+1", 037}, {"A+1", 067}, {"D-1", 016},
+        {"A-1", 062}, {"D+A", 002}, {"A+D", 002}, {"D-A", 023}, {"A-D", 007}, {"D&A", 000},
+        {"A&D", 000}, {"D|A", 025}, {"A|D", 025}};
+    return table;
+}
+
+static const map<string, int>& jumps() {
+    static const map<string, int> table = {
+        {"JGT", 1}, {"JEQ", 2}, {"JGE", 3}, {"JLT", 4}, {"JNE", 5}, {"JLE", 6}, {"JMP", 7}};
+    return table;
+}
+
+static bool symbolValue(const string& symbol, int& value) {
+    static const map<string, int> predefined = {
+        {"SP", 0}, {"LCL", 1}, {"ARG", 2}, {"THIS", 3}, {"THAT", 4}, {"SCREEN", 16384}, {"KBD", 24576}};
+
+    if (!symbol.empty() && isdigit((unsigned char)symbol[0])) {
+        value = stoi(symbol);
+        return true;
+    }
+    if (symbol.size() > 1 && symbol[0] == 'R' && isdigit((unsigned char)symbol[1])) {
+        value = stoi(symbol.substr(1));
+        return value < 16;
+    }
+    auto entry = predefined.find(symbol);
+    if (entry == predefined.end())
+        return false;
+    value = entry->second;
+    return true;
+}
+
+HackEmulator::HackEmulator() : ram(RAM_SIZE, 0), executed(0) {}
+
+bool HackEmulator::decode(const string& line, Instruction& instruction) {
+    instruction = Instruction();
+    if (line[0] == '@') {
+        instruction.is_address = true;
+        return symbolValue(line.substr(1), instruction.value) && instruction.value >= 0 &&
+               instruction.value < 32768;
+    }
+
+    string comp = line;
+    size_t equals = comp.find('=');
+    if (equals != string::npos) {
+        string dest = comp.substr(0, equals);
+        instruction.store_a = dest.find('A') != string::npos;
+        instruction.store_d = dest.find('D') != string::npos;
+        instruction.store_m = dest.find('M') != string::npos;
+        comp = comp.substr(equals + 1);
+    }
+
+    size_t semicolon = comp.find(';');
+    if (semicolon != string::npos) {
+        auto jump = jumps().find(comp.substr(semicolon + 1));
+        if (jump == jumps().end())
+            return false;
+        instruction.jump = jump->second;
+        comp = comp.substr(0, semicolon);
+    }
+
+    instruction.reads_memory = comp.find('M') != string::npos;
+    for (char& c : comp) {
+        if (c == 'M')
+            c = 'A';
+    }
+    auto control = computations().find(comp);
+    if (control == computations().end())
+        return false;
+    instruction.control = control->second;
+    return true;
+}
+
+bool HackEmulator::load(const vector<string>& program) {
+    rom.clear();
+    ram.assign(RAM_SIZE, 0);
+    executed = 0;
+    last_error.clear();
+
+    for (string line : program) {
+        removeChars(line, " \t\r");
+        if (line.empty() || line.compare(0, 2, "//") == 0)
+            continue;
+        Instruction instruction;
+        if (!decode(line, instruction)) {
+            last_error = "cannot decode \"" + line + "\" at " + to_string(rom.size());
+            return false;
+        }
+        rom.push_back(instruction);
+    }
+    return true;
+}
+
+bool HackEmulator::run(long max_cycles) {
+    int16_t a = 0;
+    int16_t d = 0;
+    size_t pc = 0;
+
+    while (executed < max_cycles) {
+        if (pc >= rom.size()) {
+            last_error = "ran past the end of ROM";
+            return false;
+        }
+        const Instruction& instruction = rom[pc];
+        executed++;
+
+        if (instruction.is_address) {
+            a = instruction.value;
+            pc++;
+            continue;
+        }
+
+        int control = instruction.control;
+        int16_t x = d;
+        int16_t y = instruction.reads_memory ? ram[a & 0x7fff] : a;
+        if (control & 040) x = 0;
+        if (control & 020) x = ~x;
+        if (control & 010) y = 0;
+        if (control & 004) y = ~y;
+        int16_t out = (control & 002) ? (int16_t)(x + y) : (int16_t)(x & y);
+        if (control & 001) out = ~out;
+
+        int16_t address = a;
+        if (instruction.store_m)
+            ram[address & 0x7fff] = out;
+        if (instruction.store_a)
+            a = out;
+        if (instruction.store_d)
+            d = out;
+
+        bool taken = ((instruction.jump & 4) && out < 0) || ((instruction.jump & 2) && out == 0) ||
+                     ((instruction.jump & 1) && out > 0);
+        if (!taken) {
+            pc++;
+        } else if (address == (int)pc && !instruction.store_a) {
+            return true;
+        } else {
+            pc = address & 0x7fff;
+        }
+    }
+
+    last_error = "no halt within " + to_string(max_cycles) + " cycles";
+    return false;
+}
+
+int16_t HackEmulator::peek(int address) const {
+    return ram[address & 0x7fff];
+}
+
+size_t HackEmulator::romSize() const {
+    return rom.size();
+}
+
+long HackEmulator::cycles() const {
+    return executed;
+}
+
+const string& HackEmulator::error() const {
+    return last_error;
+}
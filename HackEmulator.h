@@ -0,0 +1,41 @@
+#ifndef HACKEMULATOR_H_
+#define HACKEMULATOR_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Executes linked Hack assembly: "@" lines with a number or a predefined
+// symbol (R0-R15, SP, LCL, ARG, THIS, THAT, SCREEN, KBD) and C-instructions.
+// A jump to itself, the code END compiles to, halts the program.
+class HackEmulator {
+private:
+    struct Instruction {
+        bool is_address;
+        int value;
+        int control;
+        bool reads_memory;
+        bool store_a;
+        bool store_d;
+        bool store_m;
+        int jump;
+    };
+
+    std::vector<Instruction> rom;
+    std::vector<int16_t> ram;
+    long executed;
+    std::string last_error;
+    bool decode(const std::string& line, Instruction& instruction);
+
+public:
+    static const int RAM_SIZE = 32768;
+    HackEmulator();
+    bool load(const std::vector<std::string>& program);
+    bool run(long max_cycles);
+    int16_t peek(int address) const;
+    size_t romSize() const;
+    long cycles() const;
+    const std::string& error() const;
+};
+
+#endif
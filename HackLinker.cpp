@@ -0,0 +1,215 @@
+#include "HackLinker.h"
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+
+using namespace std;
+
+HackLinker::HackLinker() {}
+
+void HackLinker::clear() {
+    objects.clear();
+    rom_base.clear();
+    global_symbols.clear();
+    program.clear();
+    link_errors.clear();
+}
+
+void HackLinker::addObject(const HackObject& object) {
+    objects.push_back(object);
+}
+
+bool HackLinker::addObjectFile(const string& filename) {
+    HackObject object;
+    if (!readObject(object, filename)) {
+        link_errors.push_back("cannot read object file " + filename);
+        return false;
+    }
+    objects.push_back(object);
+    return true;
+}
+
+void HackLinker::emitLine(const string& line) {
+    program.push_back(line);
+}
+
+void HackLinker::emitConstant(int value) {
+    if (value < 0) {
+        emitLine("@" + to_string(-value));
+        emitLine("D=A");
+        emitLine("D=-D");
+    } else {
+        emitLine("@" + to_string(value));
+        emitLine("D=A");
+    }
+}
+
+void HackLinker::collectExports() {
+    global_symbols.clear();
+    for (size_t m = 0; m < objects.size(); m++) {
+        for (const string& symbol : objects[m].exports) {
+            if (!objects[m].defines(symbol)) {
+                link_errors.push_back(objects[m].name + ": exported symbol " + symbol + " is not defined");
+                continue;
+            }
+            if (global_symbols.count(symbol)) {
+                link_errors.push_back(objects[m].name + ": duplicate definition of " + symbol +
+                                      " (also in " + objects[global_symbols[symbol].first].name + ")");
+                continue;
+            }
+            global_symbols[symbol] = make_pair(m, objects[m].labels.count(symbol) > 0);
+        }
+    }
+}
+
+void HackLinker::emitPrologue() {
+    emitLine("@" + to_string(MemoryPlanner::STACK_START));
+    emitLine("D=A");
+    emitLine("@13");
+    emitLine("M=D");
+
+    for (size_t m = 0; m < objects.size(); m++) {
+        const vector<int>& data = objects[m].data;
+        for (size_t i = 0; i < data.size(); i++) {
+            emitConstant(data[i]);
+            emitLine("@" + to_string(planner.dataBase(m) + i));
+            emitLine("M=D");
+        }
+    }
+
+    rom_base.clear();
+    int next = program.size();
+    for (const HackObject& object : objects) {
+        rom_base.push_back(next);
+        next += object.code.size();
+    }
+}
+
+int HackLinker::resolveSymbol(size_t module, const string& symbol) {
+    const HackObject& object = objects[module];
+
+    auto label = object.labels.find(symbol);
+    if (label != object.labels.end())
+        return rom_base[module] + label->second;
+
+    auto variable = object.variables.find(symbol);
+    if (variable != object.variables.end())
+        return planner.dataBase(module) + variable->second;
+
+    auto global = global_symbols.find(symbol);
+    if (global != global_symbols.end()) {
+        const HackObject& owner = objects[global->second.first];
+        if (global->second.second)
+            return rom_base[global->second.first] + owner.labels.at(symbol);
+        return planner.dataBase(global->second.first) + owner.variables.at(symbol);
+    }
+
+    link_errors.push_back(object.name + ": undefined symbol " + symbol);
+    return -1;
+}
+
+void HackLinker::relocateModule(size_t module) {
+    const HackObject& object = objects[module];
+    size_t first_line = program.size();
+    program.insert(program.end(), object.code.begin(), object.code.end());
+
+    for (const Relocation& reloc : object.relocations) {
+        if (reloc.line < 0 || reloc.line >= (int)object.code.size()) {
+            link_errors.push_back(object.name + ": relocation outside code at line " + to_string(reloc.line));
+            continue;
+        }
+
+        int address = -1;
+        if (reloc.kind == RELOC_ROM) {
+            address = rom_base[module] + reloc.addend;
+        } else if (reloc.kind == RELOC_SCRATCH) {
+            address = planner.scratchAddress(reloc.addend);
+        } else {
+            address = resolveSymbol(module, reloc.symbol);
+        }
+        program[first_line + reloc.line] = "@" + to_string(address);
+    }
+}
+
+bool HackLinker::link() {
+    program.clear();
+
+    collectExports();
+    if (!planner.plan(objects, global_symbols))
+        link_errors.insert(link_errors.end(), planner.errors().begin(), planner.errors().end());
+    emitPrologue();
+
+    for (size_t m = 0; m < objects.size(); m++)
+        relocateModule(m);
+
+    return link_errors.empty();
+}
+
+bool HackLinker::link(const string& out_filename) {
+    FileSink sink;
+    if (!sink.open(out_filename)) {
+        link_errors.push_back("cannot open output file " + out_filename);
+        return false;
+    }
+    bool linked = link(sink);
+    if (!sink.close()) {
+        link_errors.push_back("cannot write output file " + out_filename);
+        return false;
+    }
+    return linked;
+}
+
+bool HackLinker::link(OutputSink& sink) {
+    bool linked = link();
+
+    for (const string& line : program)
+        sink.writeLine(line);
+
+    return linked;
+}
+
+bool HackLinker::writeMemoryMap(const string& filename) const {
+    ofstream out(filename);
+    if (!out.is_open())
+        return false;
+
+    out << "ROM" << endl;
+    int prologue_size = objects.empty() ? program.size() : rom_base[0];
+    out << "  " << setw(5) << 0 << "-" << setw(5) << left << prologue_size - 1 << right
+        << " prologue (stack and data initialization)" << endl;
+    for (size_t m = 0; m < objects.size(); m++) {
+        int size = objects[m].code.size();
+        out << "  " << setw(5) << rom_base[m] << "-" << setw(5) << left << rom_base[m] + size - 1 << right
+            << " " << objects[m].name << " (" << size << " instructions)" << endl;
+    }
+    out << "  total " << program.size() << " instructions" << endl;
+
+    planner.writeReport(out);
+
+    map<string, int> totals;
+    for (const HackObject& object : objects) {
+        for (const auto& stat : object.stats)
+            totals[stat.first] += stat.second;
+    }
+    if (!totals.empty()) {
+        out << "OPTIMIZATIONS" << endl;
+        for (const auto& total : totals) {
+            string name = total.first;
+            replace(name.begin(), name.end(), '_', ' ');
+            out << "  " << setw(6) << total.second << " " << name << endl;
+        }
+    }
+    return out.good();
+}
+
+int HackLinker::dataBase(size_t module) const {
+    return planner.dataBase(module);
+}
+
+const vector<string>& HackLinker::output() const {
+    return program;
+}
+
+const vector<string>& HackLinker::errors() const {
+    return link_errors;
+}
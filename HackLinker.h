@@ -0,0 +1,40 @@
+#ifndef HACKLINKER_H_
+#define HACKLINKER_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include "HackObject.h"
+#include "MemoryPlanner.h"
+#include "OutputSink.h"
+
+class HackLinker {
+private:
+    std::vector<HackObject> objects;
+    std::vector<int> rom_base;
+    MemoryPlanner planner;
+    std::map<std::string, std::pair<size_t, bool>> global_symbols;
+    std::vector<std::string> program;
+    std::vector<std::string> link_errors;
+    void emitLine(const std::string& line);
+    void emitConstant(int value);
+    void collectExports();
+    void emitPrologue();
+    int resolveSymbol(size_t module, const std::string& symbol);
+    void relocateModule(size_t module);
+
+public:
+    HackLinker();
+    void clear();
+    void addObject(const HackObject& object);
+    bool addObjectFile(const std::string& filename);
+    bool link();
+    bool link(const std::string& out_filename);
+    bool link(OutputSink& sink);
+    bool writeMemoryMap(const std::string& filename) const;
+    int dataBase(size_t module) const;
+    const std::vector<std::string>& output() const;
+    const std::vector<std::string>& errors() const;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include "HackObject.h"
+#include "OutputSink.h"
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+static const char* OBJECT_MAGIC = "HACKOBJ";
+static const int OBJECT_VERSION = 5;
+
+const char* const MODULE_ENTRY = ".start";
+
+void HackObject::clear() {
+    name.clear();
+    code.clear();
+    data.clear();
+    labels.clear();
+    variables.clear();
+    exports.clear();
+    imports.clear();
+    relocations.clear();
+    frames.clear();
+    stats.clear();
+    options.clear();
+}
+
+bool HackObject::defines(const string& symbol) const {
+    return labels.count(symbol) || variables.count(symbol);
+}
+
+const StackFrame* HackObject::findFrame(const string& entry) const {
+    for (const StackFrame& frame : frames) {
+        if (frame.entry == entry)
+            return &frame;
+    }
+    return nullptr;
+}
+
+static const char* relocationKindName(RelocationKind kind) {
+    switch (kind) {
+    case RELOC_ROM: return "ROM";
+    case RELOC_SCRATCH: return "TMP";
+    default: return "SYM";
+    }
+}
+
+bool writeObject(const HackObject& object, const string& filename) {
+    FileSink out;
+    if (!out.open(filename))
+        return false;
+
+    out.writeLine(string(OBJECT_MAGIC) + " " + to_string(OBJECT_VERSION));
+    out.writeLine("MODULE " + object.name);
+
+    out.writeLine("CODE " + to_string(object.code.size()));
+    for (const string& line : object.code)
+        out.writeLine(line);
+
+    out.writeLine("DATA " + to_string(object.data.size()));
+    for (int value : object.data)
+        out.writeLine(to_string(value));
+
+    for (const auto& label : object.labels)
+        out.writeLine("LABEL " + label.first + " " + to_string(label.second));
+    for (const auto& variable : object.variables)
+        out.writeLine("VAR " + variable.first + " " + to_string(variable.second));
+    for (const string& symbol : object.exports)
+        out.writeLine("EXPORT " + symbol);
+    for (const string& symbol : object.imports)
+        out.writeLine("IMPORT " + symbol);
+
+    for (const Relocation& reloc : object.relocations) {
+        string target = (reloc.kind == RELOC_SYMBOL) ? reloc.symbol : to_string(reloc.addend);
+        out.writeLine("RELOC " + to_string(reloc.line) + " " + relocationKindName(reloc.kind) + " " + target);
+    }
+
+    for (const StackFrame& frame : object.frames) {
+        out.writeLine("FRAME " + frame.entry + " " + to_string(frame.depth));
+        for (const auto& call : frame.calls)
+            out.writeLine("CALL " + frame.entry + " " + call.first + " " + to_string(call.second));
+    }
+
+    for (const auto& stat : object.stats)
+        out.writeLine("STAT " + stat.first + " " + to_string(stat.second));
+    for (const auto& option : object.options)
+        out.writeLine("OPTION " + option.first + " " + to_string(option.second));
+
+    out.writeLine("END");
+    return out.close();
+}
+
+bool readObject(HackObject& object, const string& filename) {
+    object.clear();
+
+    ifstream in(filename);
+    if (!in.is_open())
+        return false;
+
+    string magic;
+    int version = 0;
+    in >> magic >> version;
+    if (magic != OBJECT_MAGIC || version != OBJECT_VERSION)
+        return false;
+
+    string keyword;
+    while (in >> keyword) {
+        if (keyword == "MODULE") {
+            in >> object.name;
+        } else if (keyword == "CODE") {
+            size_t count = 0;
+            in >> count;
+            object.code.resize(count);
+            for (size_t i = 0; i < count; i++)
+                in >> object.code[i];
+        } else if (keyword == "DATA") {
+            size_t count = 0;
+            in >> count;
+            object.data.resize(count);
+            for (size_t i = 0; i < count; i++)
+                in >> object.data[i];
+        } else if (keyword == "LABEL") {
+            string symbol;
+            int offset = 0;
+            in >> symbol >> offset;
+            object.labels[symbol] = offset;
+        } else if (keyword == "VAR") {
+            string symbol;
+            int offset = 0;
+            in >> symbol >> offset;
+            object.variables[symbol] = offset;
+        } else if (keyword == "EXPORT") {
+            string symbol;
+            in >> symbol;
+            object.exports.insert(symbol);
+        } else if (keyword == "IMPORT") {
+            string symbol;
+            in >> symbol;
+            object.imports.insert(symbol);
+        } else if (keyword == "RELOC") {
+            Relocation reloc;
+            string kind;
+            in >> reloc.line >> kind;
+            reloc.addend = 0;
+            if (kind == "SYM") {
+                reloc.kind = RELOC_SYMBOL;
+                in >> reloc.symbol;
+            } else if (kind == "ROM" || kind == "TMP") {
+                reloc.kind = (kind == "ROM") ? RELOC_ROM : RELOC_SCRATCH;
+                in >> reloc.addend;
+            } else {
+                return false;
+            }
+            object.relocations.push_back(reloc);
+        } else if (keyword == "FRAME") {
+            StackFrame frame;
+            in >> frame.entry >> frame.depth;
+            object.frames.push_back(frame);
+        } else if (keyword == "CALL") {
+            string entry, callee;
+            int depth = 0;
+            in >> entry >> callee >> depth;
+            if (object.frames.empty() || object.frames.back().entry != entry)
+                return false;
+            object.frames.back().calls[callee] = depth;
+        } else if (keyword == "STAT") {
+            string stat;
+            int value = 0;
+            in >> stat >> value;
+            object.stats[stat] = value;
+        } else if (keyword == "OPTION") {
+            string option;
+            int value = 0;
+            in >> option >> value;
+            object.options[option] = value;
+        } else if (keyword == "END") {
+            return true;
+        } else {
+            return false;
+        }
+
+        if (!in)
+            return false;
+    }
+
+    return false;
+}
@@ -0,0 +1,71 @@
+#ifndef HACKOBJECT_H_
+#define HACKOBJECT_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+// How the linker patches an "@" line of a module's code:
+//   RELOC_ROM     - addend is a line offset inside the module's code
+//   RELOC_SYMBOL  - address of a label or variable, local first, then exported
+//   RELOC_SCRATCH - addend is a scratch slot, placed by the memory planner
+enum RelocationKind {
+    RELOC_ROM,
+    RELOC_SYMBOL,
+    RELOC_SCRATCH
+};
+
+// Scratch cells shared by all modules. Loop pointers occupy POINTER_SLOTS
+// consecutive slots and are addressed in ARM code as $P0-$P3.
+enum ScratchSlot {
+    SCRATCH_ADDRESS,
+    SCRATCH_FLAGS,
+    SCRATCH_POINTER
+};
+
+const int POINTER_SLOTS = 4;
+
+// Name of the frame that starts at the first line of a module.
+extern const char* const MODULE_ENTRY;
+
+struct Relocation {
+    int line;
+    RelocationKind kind;
+    std::string symbol;
+    int addend;
+};
+
+// Static stack usage of one entry point: the deepest stack offset reached
+// in its own body and, for every BL, the offset at the call. A depth of -1
+// means the usage could not be bounded.
+struct StackFrame {
+    std::string entry;
+    int depth;
+    std::map<std::string, int> calls;
+};
+
+// Relocatable output of translating a single ARM module. Code line numbers
+// and data offsets start at zero; the linker assigns the final addresses.
+struct HackObject {
+    std::string name;
+    std::vector<std::string> code;
+    std::vector<int> data;
+    std::map<std::string, int> labels;
+    std::map<std::string, int> variables;
+    std::set<std::string> exports;
+    std::set<std::string> imports;
+    std::vector<Relocation> relocations;
+    std::vector<StackFrame> frames;
+    std::map<std::string, int> stats;
+    std::map<std::string, int> options;
+
+    void clear();
+    bool defines(const std::string& symbol) const;
+    const StackFrame* findFrame(const std::string& entry) const;
+};
+
+bool writeObject(const HackObject& object, const std::string& filename);
+bool readObject(HackObject& object, const std::string& filename);
+
+#endif
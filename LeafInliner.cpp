@@ -0,0 +1,247 @@
+#include "LeafInliner.h"
+#include "token_io.h"
+#include <algorithm>
+
+using namespace std;
+
+static vector<string> tokensOf(string text) {
+    vector<string> tokens;
+    string token = takeToken(text);
+    while (!token.empty()) {
+        tokens.push_back(token);
+        token = takeToken(text);
+    }
+    return tokens;
+}
+
+static string bareToken(string token) {
+    removeChars(token, "=[]{}!#+-");
+    return token;
+}
+
+static bool isLinkRegister(const string& token) {
+    return token == "LR" || token == "R14";
+}
+
+static bool isProgramCounter(const string& token) {
+    return token == "PC" || token == "R15";
+}
+
+static bool isData(const vector<string>& tokens) {
+    return tokens.size() > 1 && tokens[1] == "DCD";
+}
+
+// True when control never continues with the next line.
+static bool isUnconditional(const vector<string>& tokens) {
+    const string& op = tokens[0];
+    if (op == "BAL" || op == "END")
+        return true;
+    if (op == "LDMIB") {
+        for (size_t i = 1; i < tokens.size(); i++) {
+            if (isProgramCounter(bareToken(tokens[i])))
+                return true;
+        }
+        return false;
+    }
+    bool writes_first = (op == "MOV" || op == "ADD" || op == "SUB" || op == "RSB" ||
+                         op == "LDR" || op == "ASR");
+    return writes_first && tokens.size() > 1 && isProgramCounter(tokens[1]);
+}
+
+LeafInliner::LeafInliner(int max_instructions)
+    : threshold(max_instructions), inlined_calls(0), copies(0) {}
+
+void LeafInliner::buildIndex(const vector<SourceLine>& lines, Index& index) const {
+    index.tokens.assign(lines.size(), vector<string>());
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (lines[i].label.empty())
+            index.tokens[i] = tokensOf(lines[i].text);
+        else
+            index.label_lines.insert(make_pair(lines[i].label, i));
+    }
+
+    for (size_t i = 0; i < lines.size(); i++) {
+        const vector<string>& tokens = index.tokens[i];
+        for (size_t t = 1; t < tokens.size(); t++) {
+            string name = bareToken(tokens[t]);
+            if (index.label_lines.count(name))
+                index.references[name].push_back(i);
+        }
+        if (tokens.size() == 2 && tokens[0] == "BL") {
+            vector<size_t>& sites = index.calls[tokens[1]];
+            if (sites.empty())
+                index.callees.push_back(tokens[1]);
+            sites.push_back(i);
+        }
+    }
+}
+
+bool LeafInliner::findLeaf(const vector<SourceLine>& lines, const Index& index, size_t entry, Leaf& leaf) const {
+    leaf.entry = entry;
+    leaf.ret = 0;
+    leaf.labels.clear();
+
+    int count = 0;
+    vector<string> targets;
+    for (size_t i = entry + 1; i < lines.size() && leaf.ret == 0; i++) {
+        if (!lines[i].label.empty()) {
+            leaf.labels.insert(lines[i].label);
+            continue;
+        }
+
+        const vector<string>& tokens = index.tokens[i];
+        const string& op = tokens[0];
+        if (op == "MOV" && tokens.size() == 3 && isProgramCounter(tokens[1]) && isLinkRegister(tokens[2])) {
+            leaf.ret = i;
+            break;
+        }
+
+        if (isData(tokens) || op == "BL" || op == "END" || op == "EXPORT" ||
+            op == "GLOBAL" || op == "IMPORT" || op == "EXTERN")
+            return false;
+
+        for (size_t t = 1; t < tokens.size(); t++) {
+            string reg = bareToken(tokens[t]);
+            if (isLinkRegister(reg) || isProgramCounter(reg))
+                return false;
+        }
+
+        if (op.size() == 3 && op[0] == 'B' && tokens.size() > 1)
+            targets.push_back(tokens[1]);
+
+        if (++count > threshold)
+            return false;
+    }
+
+    if (leaf.ret == 0)
+        return false;
+
+    for (const string& target : targets) {
+        if (!leaf.labels.count(target))
+            return false;
+    }
+    for (const string& label : leaf.labels) {
+        if (isReferenced(index, label, leaf.entry, leaf.ret))
+            return false;
+    }
+    return true;
+}
+
+// Whether any line outside [begin, end] names the label as an operand.
+bool LeafInliner::isReferenced(const Index& index, const string& label, size_t begin, size_t end) const {
+    auto users = index.references.find(label);
+    if (users == index.references.end())
+        return false;
+    for (size_t user : users->second) {
+        if (user < begin || user > end)
+            return true;
+    }
+    return false;
+}
+
+// Whether control can reach the entry line other than through BL to its
+// own label: by falling through from the line above it, or through another
+// label in the run of labels directly above it.
+bool LeafInliner::isEnteredFromAbove(const vector<SourceLine>& lines, const Index& index, size_t entry) const {
+    for (size_t i = entry; i-- > 0;) {
+        if (!lines[i].label.empty()) {
+            if (index.references.count(lines[i].label))
+                return true;
+            continue;
+        }
+        if (isData(index.tokens[i]))
+            continue;
+        return !isUnconditional(index.tokens[i]);
+    }
+    return true;
+}
+
+// Whether every reference to the callee is a BL that is about to be inlined.
+bool LeafInliner::isOnlyCalled(const Index& index, const string& callee) const {
+    auto users = index.references.find(callee);
+    return users == index.references.end() || users->second.size() == index.calls.at(callee).size();
+}
+
+void LeafInliner::appendCopy(const vector<SourceLine>& lines, const Index& index, const Leaf& leaf,
+                             vector<SourceLine>& result) {
+    string suffix = "$" + to_string(++copies);
+    for (size_t j = leaf.entry + 1; j < leaf.ret; j++) {
+        SourceLine copy;
+        copy.inlined = true;
+        if (!lines[j].label.empty()) {
+            copy.label = lines[j].label + suffix;
+            copy.text = copy.label;
+        } else {
+            for (const string& token : index.tokens[j]) {
+                if (!copy.text.empty())
+                    copy.text += ' ';
+                copy.text += leaf.labels.count(token) ? token + suffix : token;
+            }
+        }
+        result.push_back(copy);
+    }
+}
+
+// Each round indexes the lines once, inlines every leaf called in them and
+// rebuilds the lines once. Inlining copies no BL, so every round removes
+// calls and the loop ends; callers that become leaves are considered in
+// later rounds.
+bool LeafInliner::run(vector<SourceLine>& lines) {
+    if (threshold <= 0)
+        return false;
+
+    bool changed = false;
+    while (true) {
+        Index index;
+        buildIndex(lines, index);
+
+        map<string, Leaf> leaves;
+        for (const string& callee : index.callees) {
+            auto entry = index.label_lines.find(callee);
+            Leaf leaf;
+            if (entry != index.label_lines.end() && findLeaf(lines, index, entry->second, leaf))
+                leaves[callee] = leaf;
+        }
+        if (leaves.empty())
+            break;
+
+        vector<char> dropped(lines.size(), 0);
+        for (const auto& leaf : leaves) {
+            if (isOnlyCalled(index, leaf.first) && !isEnteredFromAbove(lines, index, leaf.second.entry)) {
+                fill(dropped.begin() + leaf.second.entry, dropped.begin() + leaf.second.ret + 1, 1);
+                removed.push_back(vector<SourceLine>(lines.begin() + leaf.second.entry,
+                                                     lines.begin() + leaf.second.ret + 1));
+            }
+        }
+
+        vector<SourceLine> result;
+        result.reserve(lines.size());
+        for (size_t i = 0; i < lines.size(); i++) {
+            if (dropped[i])
+                continue;
+            const vector<string>& tokens = index.tokens[i];
+            auto leaf = tokens.size() == 2 && tokens[0] == "BL" ? leaves.find(tokens[1]) : leaves.end();
+            if (leaf == leaves.end()) {
+                result.push_back(lines[i]);
+                continue;
+            }
+            appendCopy(lines, index, leaf->second, result);
+            inlined_calls++;
+        }
+        lines.swap(result);
+        changed = true;
+    }
+    return changed;
+}
+
+int LeafInliner::inlinedCalls() const {
+    return inlined_calls;
+}
+
+int LeafInliner::removedFunctions() const {
+    return removed.size();
+}
+
+const vector<vector<SourceLine>>& LeafInliner::removedCopies() const {
+    return removed;
+}
@@ -0,0 +1,54 @@
+#ifndef LEAFINLINER_H_
+#define LEAFINLINER_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include "token_io.h"
+
+// Expands BL calls to small leaf functions in place. A leaf starts at a
+// label, contains no BL, does not touch LR or PC and ends with its only
+// MOV PC, LR; branches inside it must stay inside it. Its labels are
+// renamed per copy. The out-of-line copy is dropped once nothing refers to
+// it or to a label right above it and no code falls through into it;
+// removedCopies() keeps those copies so their Hack size can be measured.
+class LeafInliner {
+private:
+    struct Leaf {
+        size_t entry;
+        size_t ret;
+        std::set<std::string> labels;
+    };
+
+    // Tokens, label references and BL sites of the lines, built once per
+    // round; every leaf found in a round is inlined in one rebuild.
+    struct Index {
+        std::vector<std::vector<std::string>> tokens;
+        std::map<std::string, size_t> label_lines;
+        std::map<std::string, std::vector<size_t>> references;
+        std::map<std::string, std::vector<size_t>> calls;
+        std::vector<std::string> callees;
+    };
+
+    int threshold;
+    int inlined_calls;
+    int copies;
+    std::vector<std::vector<SourceLine>> removed;
+    void buildIndex(const std::vector<SourceLine>& lines, Index& index) const;
+    bool findLeaf(const std::vector<SourceLine>& lines, const Index& index, size_t entry, Leaf& leaf) const;
+    bool isReferenced(const Index& index, const std::string& label, size_t begin, size_t end) const;
+    bool isEnteredFromAbove(const std::vector<SourceLine>& lines, const Index& index, size_t entry) const;
+    bool isOnlyCalled(const Index& index, const std::string& callee) const;
+    void appendCopy(const std::vector<SourceLine>& lines, const Index& index, const Leaf& leaf,
+                    std::vector<SourceLine>& result);
+
+public:
+    explicit LeafInliner(int max_instructions);
+    bool run(std::vector<SourceLine>& lines);
+    int inlinedCalls() const;
+    int removedFunctions() const;
+    const std::vector<std::vector<SourceLine>>& removedCopies() const;
+};
+
+#endif
@@ -0,0 +1,301 @@
+#include "LoopOptimizer.h"
+#include "HackObject.h"
+#include <set>
+
+using namespace std;
+
+static const int MAX_ROUNDS = 8;
+
+static bool isImmediate(const string& token, int& value) {
+    if (token.size() < 2 || token[0] != '#')
+        return false;
+    value = stoi(token.substr(token[1] == '+' ? 2 : 1));
+    return true;
+}
+
+LoopOptimizer::LoopOptimizer(const map<string, int>& registers)
+    : register_map(registers), hoisted(0), reduced(0), counted(0), next_pointer(0) {}
+
+// Loops ordered by descending header, so an inner loop comes before the
+// loops around it.
+vector<LoopOptimizer::Loop> LoopOptimizer::findLoops(const vector<SourceLine>& lines,
+                                                     const FlowGraph& graph) const {
+    map<size_t, size_t> latches;
+    for (size_t b = 0; b < graph.size(); b++) {
+        size_t h = 0;
+        const string& target = graph.at(b).target;
+        if (!target.empty() && graph.findLabel(target, h) && h <= b) {
+            size_t& latch = latches[h];
+            latch = max(latch, b);
+        }
+    }
+
+    map<string, vector<size_t>> references;
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (!lines[i].label.empty())
+            continue;
+        string rest = lines[i].text;
+        takeToken(rest);
+        for (string token = takeToken(rest); !token.empty(); token = takeToken(rest)) {
+            removeChars(token, "=[]{}!#");
+            size_t index = 0;
+            if (graph.findLabel(token, index))
+                references[token].push_back(i);
+        }
+    }
+
+    vector<Loop> loops;
+    for (auto latch = latches.rbegin(); latch != latches.rend(); ++latch) {
+        Loop loop;
+        loop.header = latch->first;
+        loop.latch = latch->second;
+        loop.body_start = loop.header + 1;
+        loop.first_block_end = loop.latch;
+        loop.defs = 0;
+
+        bool entered = true;
+        for (size_t i = loop.header; i-- > 0;) {
+            if (!graph.at(i).opcode.empty()) {
+                entered = graph.at(i).falls_through;
+                break;
+            }
+        }
+
+        bool simple = entered;
+        for (size_t i = loop.header; i <= loop.latch && simple; i++) {
+            const ArmInstruction& node = graph.at(i);
+            if (node.exits || node.opcode == "END" || (node.uses & ALL_REGISTERS) == ALL_REGISTERS)
+                simple = false;
+            loop.defs |= node.defs;
+            if (node.defs)
+                loop.def_counts[node.defs]++;
+
+            if (!node.label.empty()) {
+                for (size_t user : references[node.label]) {
+                    if (user < loop.header || user > loop.latch)
+                        simple = false;
+                }
+            }
+
+            bool ends_block = !node.label.empty() || !node.target.empty() || !node.falls_through;
+            if (i > loop.header && ends_block && loop.first_block_end == loop.latch)
+                loop.first_block_end = i;
+        }
+
+        if (simple)
+            loops.push_back(loop);
+    }
+    return loops;
+}
+
+// Number of instructions in the loop that write any register in reg.
+int LoopOptimizer::countDefs(const Loop& loop, unsigned reg) const {
+    int count = 0;
+    for (const auto& defs : loop.def_counts) {
+        if (defs.first & reg)
+            count += defs.second;
+    }
+    return count;
+}
+
+// An instruction in the loop's first block runs on every iteration before
+// any exit. It can run once in front of the loop when its sources are not
+// written in the loop, its destination is written only there and the
+// destination's value from before the loop is never read.
+bool LoopOptimizer::hoistInvariants(const vector<SourceLine>& lines, const FlowGraph& graph, const Loop& loop,
+                                    Edits& edits) {
+    const unsigned reserved = (1u << register_map.at("SP")) | (1u << register_map.at("LR")) |
+                              (1u << register_map.at("PC"));
+    unsigned live_in = graph.liveIn(loop.header);
+
+    set<size_t> moved;
+    for (size_t k = loop.body_start; k < loop.first_block_end; k++) {
+        const ArmInstruction& node = graph.at(k);
+        const string& op = node.opcode;
+        bool candidate = (op == "MOV" || op == "ADD" || op == "SUB" || op == "RSB") ||
+                         (op == "LDR" && node.operands.size() == 2 && node.operands[1][0] == '=');
+        unsigned dest = node.defs;
+
+        if (!candidate || dest == 0 || (dest & (dest - 1)) != 0 || (dest & reserved) ||
+            (dest & ~ALL_REGISTERS) || (node.uses & loop.defs) || (live_in & dest) ||
+            countDefs(loop, dest) != 1)
+            continue;
+        moved.insert(k);
+    }
+
+    if (moved.empty())
+        return false;
+
+    vector<SourceLine>& front = edits.before[loop.header];
+    for (size_t k : moved) {
+        front.push_back(lines[k]);
+        edits.moved.insert(k);
+    }
+    hoisted += moved.size();
+    return true;
+}
+
+// Rewrites [Rb, Ri, LSL #k] accesses to [$Pn] where $Pn = Rb + (Ri << k) is
+// set up in front of the loop and stepped right after Ri's only update.
+bool LoopOptimizer::reduceStrength(const FlowGraph& graph, const Loop& loop, Edits& edits) {
+    map<string, pair<size_t, int>> induction;
+    for (size_t k = loop.body_start; k < loop.first_block_end; k++) {
+        const ArmInstruction& node = graph.at(k);
+        int step = 0;
+        if ((node.opcode == "ADD" || node.opcode == "SUB") && node.operands.size() == 3 &&
+            node.operands[0] == node.operands[1] && register_map.count(node.operands[0]) &&
+            isImmediate(node.operands[2], step) && countDefs(loop, node.defs) == 1)
+            induction[node.operands[0]] = make_pair(k, node.opcode == "ADD" ? step : -step);
+    }
+    if (induction.empty())
+        return false;
+
+    struct Pointer {
+        string name;
+        string base;
+        string index;
+        int shift;
+    };
+    vector<Pointer> pointers;
+    map<size_t, string> rewrites;
+
+    for (size_t k = loop.body_start; k < loop.latch; k++) {
+        const ArmInstruction& node = graph.at(k);
+        if ((node.opcode != "LDR" && node.opcode != "STR") || node.operands.size() < 2)
+            continue;
+
+        string text;
+        for (size_t t = 1; t < node.operands.size(); t++)
+            text += (t > 1 ? " " : "") + node.operands[t];
+        MemoryOperand address = parseMemoryOperand(text);
+
+        auto base = register_map.find(address.base);
+        if (address.index.empty() || address.subtract || address.writeback || base == register_map.end() ||
+            !induction.count(address.index) || address.base == address.index ||
+            (loop.defs & (1u << base->second)))
+            continue;
+
+        size_t p = 0;
+        while (p < pointers.size() && (pointers[p].base != address.base || pointers[p].index != address.index ||
+                                       pointers[p].shift != address.shift))
+            p++;
+        if (p == pointers.size()) {
+            if (next_pointer >= POINTER_SLOTS)
+                continue;
+            Pointer pointer = {"$P" + to_string(next_pointer++), address.base, address.index, address.shift};
+            pointers.push_back(pointer);
+        }
+        rewrites[k] = node.opcode + " " + node.operands[0] + " [" + pointers[p].name + "]";
+    }
+
+    if (rewrites.empty())
+        return false;
+
+    vector<SourceLine>& front = edits.before[loop.header];
+    for (const Pointer& pointer : pointers) {
+        SourceLine line;
+        line.text = "MOV " + pointer.name + " " + pointer.index;
+        front.push_back(line);
+        for (int s = 0; s < pointer.shift; s++) {
+            line.text = "ADD " + pointer.name + " " + pointer.name + " " + pointer.name;
+            front.push_back(line);
+        }
+        line.text = "ADD " + pointer.name + " " + pointer.name + " " + pointer.base;
+        front.push_back(line);
+
+        const pair<size_t, int>& step = induction[pointer.index];
+        int amount = step.second * (1 << pointer.shift);
+        line.text = string(amount < 0 ? "SUB " : "ADD ") + pointer.name + " " + pointer.name +
+                    " #" + to_string(amount < 0 ? -amount : amount);
+        edits.after[step.first].push_back(line);
+    }
+
+    edits.rewrites.insert(rewrites.begin(), rewrites.end());
+    reduced += rewrites.size();
+    return true;
+}
+
+// SUB Rn, Rn, #1 / CMP Rn, #0 / Bxx at the back edge. Only counted for
+// the memory map; the code is not changed. The tight latch comes from the
+// generic in-place update of Rd = Rd +/- x in ArmToHack::updateInPlace
+// and from CMP reusing the value left in D.
+bool LoopOptimizer::isCountedLoop(const FlowGraph& graph, const Loop& loop) const {
+    if (loop.latch < loop.header + 2)
+        return false;
+    const ArmInstruction& compare = graph.at(loop.latch - 1);
+    const ArmInstruction& step = graph.at(loop.latch - 2);
+    return compare.opcode == "CMP" && compare.operands.size() == 2 && compare.operands[1] == "#0" &&
+           step.opcode == "SUB" && step.operands.size() == 3 && step.operands[0] == compare.operands[0] &&
+           step.operands[1] == compare.operands[0] && step.operands[2] == "#1";
+}
+
+void LoopOptimizer::applyEdits(vector<SourceLine>& lines, const Edits& edits) const {
+    vector<SourceLine> result;
+    result.reserve(lines.size() + edits.before.size() + edits.after.size());
+    for (size_t i = 0; i < lines.size(); i++) {
+        auto before = edits.before.find(i);
+        if (before != edits.before.end())
+            result.insert(result.end(), before->second.begin(), before->second.end());
+        if (edits.moved.count(i))
+            continue;
+
+        result.push_back(lines[i]);
+        auto rewrite = edits.rewrites.find(i);
+        if (rewrite != edits.rewrites.end())
+            result.back().text = rewrite->second;
+
+        auto after = edits.after.find(i);
+        if (after != edits.after.end())
+            result.insert(result.end(), after->second.begin(), after->second.end());
+    }
+    lines.swap(result);
+}
+
+// Each round changes loops that do not overlap one another, collecting the
+// changes and applying them in one pass, then rebuilds the graph, so
+// invariants of inner loops can move further out next round.
+bool LoopOptimizer::run(vector<SourceLine>& lines) {
+    bool changed = false;
+    for (int round = 0; round < MAX_ROUNDS; round++) {
+        FlowGraph graph(register_map);
+        graph.build(lines);
+        vector<Loop> loops = findLoops(lines, graph);
+
+        if (round == 0) {
+            for (const Loop& loop : loops) {
+                if (isCountedLoop(graph, loop))
+                    counted++;
+            }
+        }
+
+        Edits edits;
+        bool progress = false;
+        size_t lowest_changed = lines.size();
+        for (const Loop& loop : loops) {
+            if (loop.latch >= lowest_changed)
+                continue;
+            if (hoistInvariants(lines, graph, loop, edits) || reduceStrength(graph, loop, edits)) {
+                lowest_changed = loop.header;
+                progress = true;
+            }
+        }
+
+        if (!progress)
+            break;
+        applyEdits(lines, edits);
+        changed = true;
+    }
+    return changed;
+}
+
+int LoopOptimizer::hoistedInstructions() const {
+    return hoisted;
+}
+
+int LoopOptimizer::reducedAccesses() const {
+    return reduced;
+}
+
+int LoopOptimizer::countedLoops() const {
+    return counted;
+}
@@ -0,0 +1,62 @@
+#ifndef LOOPOPTIMIZER_H_
+#define LOOPOPTIMIZER_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include "token_io.h"
+#include "FlowGraph.h"
+
+// Source-level loop pass. Loops are found from back edges in the flow
+// graph: a branch to a label at or above it. Only loops entered by falling
+// into their header label, whose labels are not referenced from outside,
+// and that contain no BL or write to PC are changed.
+//
+// Invariant MOV/ADD/SUB/RSB and LDR =symbol instructions at the top of the
+// loop move in front of it. Loads and stores through [Rb, Ri, LSL #k], with
+// Rb unchanged in the loop and Ri stepped by a constant once per iteration,
+// go through a loop pointer ($P0-$P3) that is stepped alongside Ri.
+class LoopOptimizer {
+private:
+    struct Loop {
+        size_t header;
+        size_t latch;
+        size_t body_start;
+        size_t first_block_end;
+        unsigned defs;
+        std::map<unsigned, int> def_counts;
+    };
+
+    // Changes of one round, applied in a single pass over the lines:
+    // lines inserted in front of a loop header, lines moved out of their
+    // place, rewritten lines and lines inserted after a line.
+    struct Edits {
+        std::map<size_t, std::vector<SourceLine>> before;
+        std::set<size_t> moved;
+        std::map<size_t, std::string> rewrites;
+        std::map<size_t, std::vector<SourceLine>> after;
+    };
+
+    const std::map<std::string, int>& register_map;
+    int hoisted;
+    int reduced;
+    int counted;
+    int next_pointer;
+    std::vector<Loop> findLoops(const std::vector<SourceLine>& lines, const FlowGraph& graph) const;
+    int countDefs(const Loop& loop, unsigned reg) const;
+    bool hoistInvariants(const std::vector<SourceLine>& lines, const FlowGraph& graph, const Loop& loop,
+                         Edits& edits);
+    bool reduceStrength(const FlowGraph& graph, const Loop& loop, Edits& edits);
+    void applyEdits(std::vector<SourceLine>& lines, const Edits& edits) const;
+    bool isCountedLoop(const FlowGraph& graph, const Loop& loop) const;
+
+public:
+    explicit LoopOptimizer(const std::map<std::string, int>& registers);
+    bool run(std::vector<SourceLine>& lines);
+    int hoistedInstructions() const;
+    int reducedAccesses() const;
+    int countedLoops() const;
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include "MemoryPlanner.h"
+#include <iomanip>
+
+using namespace std;
+
+static const char* scratchSlotName(int slot) {
+    switch (slot) {
+    case SCRATCH_ADDRESS: return "address scratch";
+    case SCRATCH_FLAGS: return "flag cell";
+    default: return slot >= SCRATCH_POINTER ? "loop pointer" : "scratch";
+    }
+}
+
+MemoryPlanner::MemoryPlanner()
+    : objects(nullptr), global_symbols(nullptr), data_end(REGISTER_COUNT), stack_depth(0) {}
+
+bool MemoryPlanner::plan(const vector<HackObject>& modules,
+                         const map<string, pair<size_t, bool>>& exports) {
+    objects = &modules;
+    global_symbols = &exports;
+    scratch_address.clear();
+    data_base.clear();
+    frame_depth.clear();
+    active_frames.clear();
+    plan_errors.clear();
+
+    allocateScratch();
+    allocateData();
+
+    stack_depth = modules.empty() ? 0 : computeFrameDepth(0, MODULE_ENTRY);
+
+    if (data_end > RAM_END) {
+        plan_errors.push_back("data needs " + to_string(data_end - RAM_END) +
+                              " more words than RAM provides");
+    } else if (stack_depth >= 0 && data_end > stackBottom()) {
+        plan_errors.push_back("stack of " + to_string(stack_depth) + " words overlaps data ending at " +
+                              to_string(data_end - 1));
+    }
+
+    return plan_errors.empty();
+}
+
+void MemoryPlanner::allocateScratch() {
+    set<int> used;
+    for (const HackObject& object : *objects) {
+        for (const Relocation& reloc : object.relocations) {
+            if (reloc.kind == RELOC_SCRATCH)
+                used.insert(reloc.addend);
+        }
+    }
+
+    int next = REGISTER_COUNT;
+    for (int slot : used)
+        scratch_address[slot] = next++;
+    data_end = next;
+}
+
+void MemoryPlanner::allocateData() {
+    for (const HackObject& object : *objects) {
+        data_base.push_back(data_end);
+        data_end += object.data.size();
+    }
+}
+
+bool MemoryPlanner::findCallee(size_t module, const string& callee, size_t& owner) {
+    if ((*objects)[module].labels.count(callee)) {
+        owner = module;
+        return true;
+    }
+    auto global = global_symbols->find(callee);
+    if (global != global_symbols->end() && global->second.second) {
+        owner = global->second.first;
+        return true;
+    }
+    return false;
+}
+
+int MemoryPlanner::computeFrameDepth(size_t module, const string& entry) {
+    pair<size_t, string> key(module, entry);
+
+    auto known = frame_depth.find(key);
+    if (known != frame_depth.end())
+        return known->second;
+
+    // A callee without a traced frame has unknown stack usage.
+    const StackFrame* frame = (*objects)[module].findFrame(entry);
+    if (frame == nullptr || frame->depth < 0 || active_frames.count(key))
+        return -1;
+
+    active_frames.insert(key);
+    int depth = frame->depth;
+    for (const auto& call : frame->calls) {
+        size_t owner = 0;
+        if (!findCallee(module, call.first, owner))
+            continue;
+        int callee_depth = computeFrameDepth(owner, call.first);
+        if (callee_depth < 0) {
+            depth = -1;
+            break;
+        }
+        depth = max(depth, call.second + callee_depth);
+    }
+    active_frames.erase(key);
+
+    frame_depth[key] = depth;
+    return depth;
+}
+
+int MemoryPlanner::scratchAddress(int slot) const {
+    auto it = scratch_address.find(slot);
+    return it == scratch_address.end() ? -1 : it->second;
+}
+
+int MemoryPlanner::dataBase(size_t module) const {
+    return module < data_base.size() ? data_base[module] : -1;
+}
+
+int MemoryPlanner::stackDepth() const {
+    return stack_depth;
+}
+
+int MemoryPlanner::stackBottom() const {
+    return STACK_START - max(stack_depth, 0) + 1;
+}
+
+const vector<string>& MemoryPlanner::errors() const {
+    return plan_errors;
+}
+
+void MemoryPlanner::writeReport(ostream& out) const {
+    if (objects == nullptr)
+        return;
+
+    out << "RAM" << endl;
+    out << "  " << setw(5) << 0 << "-" << setw(5) << left << REGISTER_COUNT - 1 << right
+        << " registers R0-R15" << endl;
+
+    for (const auto& scratch : scratch_address) {
+        out << "  " << setw(5) << scratch.second << "      "
+            << " " << scratchSlotName(scratch.first) << endl;
+    }
+
+    for (size_t m = 0; m < objects->size(); m++) {
+        const HackObject& object = (*objects)[m];
+        map<int, string> by_offset;
+        for (const auto& variable : object.variables)
+            by_offset[variable.second] = variable.first;
+
+        for (auto it = by_offset.begin(); it != by_offset.end(); ++it) {
+            auto next = it;
+            ++next;
+            int size = (next == by_offset.end() ? (int)object.data.size() : next->first) - it->first;
+            int first = data_base[m] + it->first;
+            out << "  " << setw(5) << first << "-" << setw(5) << left << first + size - 1 << right
+                << " " << it->second << " (" << object.name << ", " << size
+                << (size == 1 ? " word)" : " words)") << endl;
+        }
+    }
+
+    if (stack_depth < 0) {
+        out << "  " << setw(5) << STACK_START << "      "
+            << " stack (top; depth unbounded: recursion or dynamic SP update)" << endl;
+    } else if (stack_depth == 0) {
+        out << "  " << setw(5) << STACK_START << "      "
+            << " stack (top; unused)" << endl;
+    } else {
+        out << "  " << setw(5) << stackBottom() << "-" << setw(5) << left << STACK_START << right
+            << " stack (max depth " << stack_depth << " words)" << endl;
+    }
+
+    int free_words = (stack_depth < 0 ? STACK_START : stackBottom()) - data_end;
+    out << "  data ends at " << data_end - 1 << ", " << max(free_words, 0) << " words free" << endl;
+}
@@ -0,0 +1,45 @@
+#ifndef MEMORYPLANNER_H_
+#define MEMORYPLANNER_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <ostream>
+#include "HackObject.h"
+
+// Lays out RAM for a set of linked modules: the register file, the scratch
+// cells the modules actually use, their DCD data packed back to back, and a
+// stack region sized from the static stack depth of the program.
+class MemoryPlanner {
+private:
+    const std::vector<HackObject>* objects;
+    const std::map<std::string, std::pair<size_t, bool>>* global_symbols;
+    std::map<int, int> scratch_address;
+    std::vector<int> data_base;
+    std::map<std::pair<size_t, std::string>, int> frame_depth;
+    std::set<std::pair<size_t, std::string>> active_frames;
+    int data_end;
+    int stack_depth;
+    std::vector<std::string> plan_errors;
+    void allocateScratch();
+    void allocateData();
+    int computeFrameDepth(size_t module, const std::string& entry);
+    bool findCallee(size_t module, const std::string& callee, size_t& owner);
+
+public:
+    static const int REGISTER_COUNT = 16;
+    static const int STACK_START = 16380;
+    static const int RAM_END = 16384;
+    MemoryPlanner();
+    bool plan(const std::vector<HackObject>& modules,
+              const std::map<std::string, std::pair<size_t, bool>>& exports);
+    int scratchAddress(int slot) const;
+    int dataBase(size_t module) const;
+    int stackDepth() const;
+    int stackBottom() const;
+    const std::vector<std::string>& errors() const;
+    void writeReport(std::ostream& out) const;
+};
+
+#endif
@@ -0,0 +1,179 @@
+#include "OutputSink.h"
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+using namespace std;
+
+OutputSink::OutputSink(size_t capacity) : buffer(capacity > 0 ? capacity : 1), used(0), failed(false) {}
+
+OutputSink::~OutputSink() {}
+
+void OutputSink::setFailed() {
+    failed = true;
+}
+
+void OutputSink::write(const char* data, size_t size) {
+    if (used + size <= buffer.size()) {
+        memcpy(buffer.data() + used, data, size);
+        used += size;
+        return;
+    }
+
+    if (size < buffer.size()) {
+        if (!writeOut(buffer.data(), used, nullptr, 0))
+            failed = true;
+        memcpy(buffer.data(), data, size);
+        used = size;
+        return;
+    }
+
+    if (!writeOut(buffer.data(), used, data, size))
+        failed = true;
+    used = 0;
+}
+
+void OutputSink::write(const string& text) {
+    write(text.data(), text.size());
+}
+
+void OutputSink::writeLine(const string& line) {
+    if (used + line.size() + 1 <= buffer.size()) {
+        memcpy(buffer.data() + used, line.data(), line.size());
+        used += line.size();
+        buffer[used++] = '\n';
+        return;
+    }
+    write(line.data(), line.size());
+    write("\n", 1);
+}
+
+bool OutputSink::flush() {
+    if (used > 0) {
+        if (!writeOut(buffer.data(), used, nullptr, 0))
+            failed = true;
+        used = 0;
+    }
+    return !failed;
+}
+
+bool OutputSink::good() const {
+    return !failed;
+}
+
+void OutputSink::reset() {
+    used = 0;
+    failed = false;
+}
+
+FdSink::FdSink(int fd, bool owns_fd, size_t capacity) : OutputSink(capacity), fd(fd), owns_fd(owns_fd) {}
+
+FdSink::~FdSink() {
+    close();
+}
+
+void FdSink::attach(int new_fd, bool owns) {
+    close();
+    reset();
+    fd = new_fd;
+    owns_fd = owns;
+}
+
+bool FdSink::close() {
+    if (fd < 0)
+        return good();
+
+    bool ok = flush();
+    if (owns_fd && ::close(fd) != 0)
+        ok = false;
+    fd = -1;
+    owns_fd = false;
+    return ok;
+}
+
+bool FdSink::isOpen() const {
+    return fd >= 0;
+}
+
+bool FdSink::writeOut(const char* data, size_t size, const char* extra, size_t extra_size) {
+    if (fd < 0)
+        return false;
+
+    struct iovec parts[2];
+    parts[0].iov_base = const_cast<char*>(data);
+    parts[0].iov_len = size;
+    parts[1].iov_base = const_cast<char*>(extra);
+    parts[1].iov_len = extra_size;
+
+    int first = (size == 0) ? 1 : 0;
+    int count = (extra_size == 0) ? 1 : 2;
+    while (first < count) {
+        ssize_t written = ::writev(fd, parts + first, count - first);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        size_t remaining = written;
+        while (first < count && remaining >= parts[first].iov_len) {
+            remaining -= parts[first].iov_len;
+            first++;
+        }
+        if (first < count) {
+            parts[first].iov_base = static_cast<char*>(parts[first].iov_base) + remaining;
+            parts[first].iov_len -= remaining;
+        }
+    }
+    return true;
+}
+
+FileSink::FileSink() : FdSink() {}
+
+FileSink::FileSink(const string& filename) : FdSink() {
+    open(filename);
+}
+
+bool FileSink::open(const string& filename) {
+    int new_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    attach(new_fd, true);
+    if (new_fd < 0) {
+        setFailed();
+        return false;
+    }
+    return true;
+}
+
+MemorySink::MemorySink(size_t capacity) : OutputSink(capacity) {}
+
+bool MemorySink::writeOut(const char* data, size_t size, const char* extra, size_t extra_size) {
+    contents.append(data, size);
+    if (extra_size > 0)
+        contents.append(extra, extra_size);
+    return true;
+}
+
+const string& MemorySink::str() {
+    flush();
+    return contents;
+}
+
+void MemorySink::clear() {
+    reset();
+    contents.clear();
+}
+
+NullSink::NullSink() : OutputSink(), bytes(0) {}
+
+bool NullSink::writeOut(const char* data, size_t size, const char* extra, size_t extra_size) {
+    (void)data;
+    (void)extra;
+    bytes += size + extra_size;
+    return true;
+}
+
+size_t NullSink::bytesWritten() {
+    flush();
+    return bytes;
+}
@@ -0,0 +1,89 @@
+#ifndef OUTPUTSINK_H_
+#define OUTPUTSINK_H_
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Buffered destination for generated text. Writes are collected in one
+// reusable buffer and handed to the backend only when it fills up or on
+// flush(), so emitting an instruction never costs a system call.
+class OutputSink {
+private:
+    std::vector<char> buffer;
+    size_t used;
+    bool failed;
+
+protected:
+    // Hands the buffered bytes followed by `extra` to the backend.
+    virtual bool writeOut(const char* data, size_t size, const char* extra, size_t extra_size) = 0;
+    void setFailed();
+
+public:
+    static const size_t DEFAULT_CAPACITY = 1 << 16;
+    explicit OutputSink(size_t capacity = DEFAULT_CAPACITY);
+    virtual ~OutputSink();
+    void write(const char* data, size_t size);
+    void write(const std::string& text);
+    void writeLine(const std::string& line);
+    bool flush();
+    bool good() const;
+    void reset();
+};
+
+// Writes to an already open file descriptor with write()/writev().
+class FdSink : public OutputSink {
+private:
+    int fd;
+    bool owns_fd;
+
+protected:
+    bool writeOut(const char* data, size_t size, const char* extra, size_t extra_size);
+
+public:
+    explicit FdSink(int fd = -1, bool owns_fd = false, size_t capacity = DEFAULT_CAPACITY);
+    FdSink(const FdSink&) = delete;
+    FdSink& operator=(const FdSink&) = delete;
+    ~FdSink();
+    void attach(int new_fd, bool owns);
+    bool close();
+    bool isOpen() const;
+};
+
+// Creates or truncates a file; open() may be called again to reuse the
+// buffer for the next output file.
+class FileSink : public FdSink {
+public:
+    FileSink();
+    explicit FileSink(const std::string& filename);
+    bool open(const std::string& filename);
+};
+
+// Collects the output in memory.
+class MemorySink : public OutputSink {
+private:
+    std::string contents;
+
+protected:
+    bool writeOut(const char* data, size_t size, const char* extra, size_t extra_size);
+
+public:
+    explicit MemorySink(size_t capacity = DEFAULT_CAPACITY);
+    const std::string& str();
+    void clear();
+};
+
+// Discards the output and only counts it; used for benchmarking.
+class NullSink : public OutputSink {
+private:
+    size_t bytes;
+
+protected:
+    bool writeOut(const char* data, size_t size, const char* extra, size_t extra_size);
+
+public:
+    NullSink();
+    size_t bytesWritten();
+};
+
+#endif
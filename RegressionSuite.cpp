@@ -0,0 +1,653 @@
+#include "RegressionSuite.h"
+#include "ArmToHack.h"
+#include "HackLinker.h"
+#include "HackEmulator.h"
+#include "MemoryPlanner.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+using namespace std;
+
+static const int STATE_REGISTERS = 14;
+static const int SP_REGISTER = 13;
+
+static string dataLine(const string& label, const vector<int>& values) {
+    string line = label + " DCD ";
+    for (size_t i = 0; i < values.size(); i++)
+        line += (i ? ", " : "") + to_string(values[i]);
+    return line + "\n";
+}
+
+// Counted loop over an array with an invariant address load in the body.
+static string sumArray(Expectation& expected) {
+    vector<int> values;
+    int sum = 0;
+    for (int i = 0; i < 256; i++) {
+        values.push_back(i % 17 - 8);
+        sum += values.back();
+    }
+    expected.registers = {{2, 256}, {3, values.back()}, {7, sum}};
+    expected.pointers = {{1, {"total", 0}}};
+    expected.data = {{"values", values}, {"total", {sum}}};
+    expected.features = {"hoisted_instructions", "strength_reduced_accesses"};
+    return "        MOV R2, #0\n"
+           "        MOV R5, #256\n"
+           "        MOV R7, #0\n"
+           "sum\n"
+           "        LDR R1, =values\n"
+           "        LDR R3, [R1, R2]\n"
+           "        ADD R7, R7, R3\n"
+           "        ADD R2, R2, #1\n"
+           "        SUB R5, R5, #1\n"
+           "        CMP R5, #0\n"
+           "        BNE sum\n"
+           "        LDR R1, =total\n"
+           "        STR R7, [R1]\n"
+           "        END\n" +
+           dataLine("values", values) + dataLine("total", {0});
+}
+
+static string bubbleSort(Expectation& expected) {
+    vector<int> values;
+    for (int i = 0; i < 32; i++)
+        values.push_back((i * 37 + 11) % 101);
+
+    vector<int> sorted = values;
+    int first = 0, second = 0, offset = 0;
+    for (int pass = 31; pass > 0; pass--) {
+        offset = 0;
+        for (int left = pass; left > 0; left--, offset++) {
+            first = sorted[offset];
+            second = sorted[offset + 1];
+            if (first > second)
+                swap(sorted[offset], sorted[offset + 1]);
+        }
+    }
+    expected.registers = {{2, first}, {3, second}};
+    expected.pointers = {{1, {"values", 0}}, {4, {"values", offset}}};
+    expected.data = {{"values", sorted}};
+    return "        LDR R1, =values\n"
+           "        MOV R6, #31\n"
+           "outer\n"
+           "        MOV R4, R1\n"
+           "        MOV R5, R6\n"
+           "inner\n"
+           "        LDR R2, [R4]\n"
+           "        LDR R3, [R4, #1]\n"
+           "        CMP R2, R3\n"
+           "        BLE ordered\n"
+           "        STR R3, [R4]\n"
+           "        STR R2, [R4, #1]\n"
+           "ordered\n"
+           "        ADD R4, R4, #1\n"
+           "        SUB R5, R5, #1\n"
+           "        CMP R5, #0\n"
+           "        BNE inner\n"
+           "        SUB R6, R6, #1\n"
+           "        CMP R6, #0\n"
+           "        BNE outer\n"
+           "        END\n" +
+           dataLine("values", values);
+}
+
+static int fib(int n) {
+    return n < 2 ? n : fib(n - 1) + fib(n - 2);
+}
+
+static string fibonacci(Expectation& expected) {
+    expected.registers = {{0, fib(14)}, {8, fib(14)}};
+    return "        MOV R0, #14\n"
+           "        BL fib\n"
+           "        MOV R8, R0\n"
+           "        END\n"
+           "fib\n"
+           "        CMP R0, #2\n"
+           "        BLT leaf\n"
+           "        STMDA SP!, {LR, R4, R5}\n"
+           "        MOV R4, R0\n"
+           "        SUB R0, R4, #1\n"
+           "        BL fib\n"
+           "        MOV R5, R0\n"
+           "        SUB R0, R4, #2\n"
+           "        BL fib\n"
+           "        ADD R0, R0, R5\n"
+           "        LDMIB SP!, {R5, R4, LR}\n"
+           "leaf\n"
+           "        MOV PC, LR\n";
+}
+
+// 8x8 matrix product; multiplication is a call to a repeated-addition loop.
+static string matrixProduct(Expectation& expected) {
+    vector<int> a, b, c(64, 0);
+    for (int i = 0; i < 64; i++) {
+        a.push_back(i * 7 % 6);
+        b.push_back(i * 5 % 6);
+    }
+    vector<int> product(64, 0);
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 8; j++) {
+            for (int k = 0; k < 8; k++)
+                product[i * 8 + j] += a[i * 8 + k] * b[k * 8 + j];
+        }
+    }
+    expected.registers = {{0, a[63] * b[63]}, {1, 64}, {2, 8}, {3, 8}, {4, a[63]}, {7, product[63]}};
+    expected.pointers = {{8, {"mata", 0}}, {9, {"matb", 0}}, {10, {"matc", 0}},
+                         {11, {"mata", 56}}, {12, {"matc", 56}}};
+    expected.data = {{"mata", a}, {"matb", b}, {"matc", product}};
+    return "        LDR R8, =mata\n"
+           "        LDR R9, =matb\n"
+           "        LDR R10, =matc\n"
+           "        MOV R1, #0\n"
+           "rows\n"
+           "        MOV R2, #0\n"
+           "cols\n"
+           "        MOV R7, #0\n"
+           "        MOV R3, #0\n"
+           "        ADD R11, R8, R1\n"
+           "dot\n"
+           "        LDR R4, [R11, R3]\n"
+           "        ADD R12, R9, R2\n"
+           "        LDR R5, [R12, R3, LSL #3]\n"
+           "        BL mul\n"
+           "        ADD R7, R7, R0\n"
+           "        ADD R3, R3, #1\n"
+           "        CMP R3, #8\n"
+           "        BNE dot\n"
+           "        ADD R12, R10, R1\n"
+           "        STR R7, [R12, R2]\n"
+           "        ADD R2, R2, #1\n"
+           "        CMP R2, #8\n"
+           "        BNE cols\n"
+           "        ADD R1, R1, #8\n"
+           "        CMP R1, #64\n"
+           "        BNE rows\n"
+           "        END\n"
+           "mul\n"
+           "        MOV R0, #0\n"
+           "        CMP R5, #0\n"
+           "        BEQ done\n"
+           "step\n"
+           "        ADD R0, R0, R4\n"
+           "        SUB R5, R5, #1\n"
+           "        CMP R5, #0\n"
+           "        BNE step\n"
+           "done\n"
+           "        MOV PC, LR\n" +
+           dataLine("mata", a) + dataLine("matb", b) + dataLine("matc", c);
+}
+
+static string halveArray(Expectation& expected) {
+    vector<int> values, halved;
+    for (int i = 0; i < 24; i++) {
+        values.push_back(i * 13 % 97 + 3);
+        halved.push_back(values.back() / 2);
+    }
+    expected.registers = {{2, 24}, {3, halved.back()}};
+    expected.pointers = {{1, {"values", 0}}};
+    expected.data = {{"values", halved}};
+    return "        LDR R1, =values\n"
+           "        MOV R2, #0\n"
+           "halve\n"
+           "        LDR R3, [R1, R2]\n"
+           "        ASR R3, R3, #1\n"
+           "        STR R3, [R1, R2]\n"
+           "        ADD R2, R2, #1\n"
+           "        CMP R2, #24\n"
+           "        BLT halve\n"
+           "        END\n" +
+           dataLine("values", values);
+}
+
+// Word copy with post-indexed addressing and a scaled gather.
+static string copyGather(Expectation& expected) {
+    vector<int> source, target(64, 0), picked(16, 0);
+    for (int i = 0; i < 64; i++)
+        source.push_back(i * i % 53);
+    vector<int> gathered;
+    for (int i = 0; i < 16; i++)
+        gathered.push_back(source[i * 4]);
+    expected.registers = {{3, source[60]}, {4, 16}};
+    expected.pointers = {{1, {"target", 0}}, {2, {"picked", 0}}};
+    expected.data = {{"source", source}, {"target", source}, {"picked", gathered}};
+    expected.features = {"strength_reduced_accesses"};
+    return "        LDR R1, =source\n"
+           "        LDR R2, =target\n"
+           "        MOV R5, #64\n"
+           "copy\n"
+           "        LDR R3, [R1], #1\n"
+           "        STR R3, [R2], #1\n"
+           "        SUB R5, R5, #1\n"
+           "        CMP R5, #0\n"
+           "        BNE copy\n"
+           "        LDR R1, =target\n"
+           "        LDR R2, =picked\n"
+           "        MOV R4, #0\n"
+           "gather\n"
+           "        LDR R3, [R1, R4, LSL #2]\n"
+           "        STR R3, [R2, R4]\n"
+           "        ADD R4, R4, #1\n"
+           "        CMP R4, #16\n"
+           "        BLT gather\n"
+           "        END\n" +
+           dataLine("source", source) + dataLine("target", target) + dataLine("picked", picked);
+}
+
+// Signed, scaled and written-back register offsets whose index register
+// is overwritten right after the access.
+static string signedIndex(Expectation& expected) {
+    vector<int> values;
+    for (int i = 0; i < 16; i++)
+        values.push_back(3 * i + 1);
+    vector<int> stored = values;
+    stored[2] = values[8];
+    expected.registers = {{1, values[2]}, {2, values[11]}, {3, values[4]}, {4, values[8]}, {12, 2}};
+    expected.pointers = {{8, {"values", 0}}, {10, {"values", 8}}, {11, {"values", 2}}};
+    expected.data = {{"values", stored}};
+    return "        LDR R8, =values\n"
+           "        ADD R10, R8, #8\n"
+           "        MOV R9, #6\n"
+           "        LDR R1, [R10, -R9]\n"
+           "        MOV R9, #3\n"
+           "        LDR R2, [R10, +R9]\n"
+           "        MOV R9, #2\n"
+           "        LDR R3, [R10, -R9, LSL #1]\n"
+           "        MOV R9, #5\n"
+           "        MOV R11, R10\n"
+           "        LDR R4, [R11], -R9\n"
+           "        MOV R9, #1\n"
+           "        STR R4, [R11, -R9]!\n"
+           "        MOV R9, #0\n"
+           "        SUB R12, R11, R8\n"
+           "        END\n" +
+           dataLine("values", values);
+}
+
+// Pre-indexed scaled writeback and post-indexed negative writeback walking
+// one pointer through an array.
+static string writebackWalk(Expectation& expected) {
+    vector<int> values;
+    for (int i = 0; i < 24; i++)
+        values.push_back(2 * i + 1);
+    vector<int> walked = values;
+    int position = 0, sum = 0, loaded = 0;
+    for (int step = 0; step < 6; step++) {
+        position += 4;
+        loaded = walked[position];
+        sum += loaded;
+        walked[position] = sum;
+        position -= 1;
+    }
+    expected.registers = {{2, 2}, {3, loaded}, {4, 3}, {7, sum}, {8, walked[7]}};
+    expected.pointers = {{1, {"values", position}}, {9, {"values", 7}}};
+    expected.data = {{"values", walked}};
+    return "        LDR R1, =values\n"
+           "        MOV R2, #2\n"
+           "        MOV R7, #0\n"
+           "        MOV R5, #6\n"
+           "walk\n"
+           "        LDR R3, [R1, R2, LSL #1]!\n"
+           "        ADD R7, R7, R3\n"
+           "        STR R7, [R1], #-1\n"
+           "        SUB R5, R5, #1\n"
+           "        CMP R5, #0\n"
+           "        BNE walk\n"
+           "        LDR R9, =values\n"
+           "        ADD R9, R9, #10\n"
+           "        MOV R4, #3\n"
+           "        LDR R8, [R9, -R4]!\n"
+           "        END\n" +
+           dataLine("values", values);
+}
+
+// Leaf functions small enough to be inlined, one with an internal branch.
+static string inlineCalls(Expectation& expected) {
+    int total = 0, accumulated = 0, difference = 0;
+    for (int count = 10; count > 0; count--) {
+        accumulated += 2 * count;
+        difference = abs(accumulated - 50);
+        total += difference;
+    }
+    difference = abs(accumulated - 200);
+    expected.registers = {{1, accumulated}, {3, difference}, {4, 200}, {7, total}, {8, difference}};
+    expected.pointers = {{9, {"result", 0}}};
+    expected.data = {{"result", {total}}};
+    expected.features = {"inlined_calls"};
+    return "        MOV R1, #0\n"
+           "        MOV R4, #50\n"
+           "        MOV R6, #10\n"
+           "        MOV R7, #0\n"
+           "again\n"
+           "        BL bump\n"
+           "        BL absdiff\n"
+           "        ADD R7, R7, R3\n"
+           "        SUB R6, R6, #1\n"
+           "        CMP R6, #0\n"
+           "        BNE again\n"
+           "        MOV R4, #200\n"
+           "        BL absdiff\n"
+           "        MOV R8, R3\n"
+           "        LDR R9, =result\n"
+           "        STR R7, [R9]\n"
+           "        END\n"
+           "bump\n"
+           "        ADD R1, R1, R6\n"
+           "        ADD R1, R1, R6\n"
+           "        MOV PC, LR\n"
+           "absdiff\n"
+           "        SUB R3, R1, R4\n"
+           "        CMP R3, #0\n"
+           "        BGE positive\n"
+           "        RSB R3, R3, #0\n"
+           "positive\n"
+           "        MOV PC, LR\n" +
+           dataLine("result", {0});
+}
+
+// Branches separated from their CMP by other instructions, a label or a
+// call that is too long to inline, so the comparison goes through the flag
+// cell.
+static string unfusedBranches(Expectation& expected) {
+    vector<int> values;
+    int positive = 0, negative = 0, zero = 0;
+    for (int i = 0; i < 20; i++) {
+        values.push_back(i * 7 % 9 - 4);
+        positive += values.back() > 0;
+        negative += values.back() < 0;
+        zero += values.back() == 0;
+    }
+    expected.registers = {{2, 20}, {3, values.back()}, {4, 1}, {5, positive}, {6, negative}, {7, zero},
+                          {8, positive > negative ? 1 : 2}, {9, positive + negative + zero - 20}};
+    expected.pointers = {{1, {"values", 0}}};
+    expected.data = {{"values", values}};
+    expected.features = {"flag_cell_stores"};
+    return "        LDR R1, =values\n"
+           "        MOV R2, #0\n"
+           "        MOV R5, #0\n"
+           "        MOV R6, #0\n"
+           "        MOV R7, #0\n"
+           "scan\n"
+           "        LDR R3, [R1, R2]\n"
+           "        CMP R3, #0\n"
+           "        ADD R2, R2, #1\n"
+           "        BGT above\n"
+           "        BLT below\n"
+           "        ADD R7, R7, #1\n"
+           "        BAL next\n"
+           "above\n"
+           "        ADD R5, R5, #1\n"
+           "        BAL next\n"
+           "below\n"
+           "        ADD R6, R6, #1\n"
+           "next\n"
+           "        CMP R2, #20\n"
+           "        BLT scan\n"
+           "        CMP R5, R6\n"
+           "        BL tally\n"
+           "decide\n"
+           "        BGT more\n"
+           "        MOV R8, #2\n"
+           "        BAL finish\n"
+           "more\n"
+           "        MOV R8, #1\n"
+           "finish\n"
+           "        END\n"
+           "tally\n"
+           "        MOV R9, R5\n"
+           "        ADD R9, R9, R6\n"
+           "        ADD R9, R9, R7\n"
+           "        SUB R9, R9, #20\n"
+           "        MOV R4, #1\n"
+           "        MOV PC, LR\n" +
+           dataLine("values", values);
+}
+
+RegressionSuite::RegressionSuite(int inline_threshold)
+    : inline_threshold(inline_threshold), max_cycles(DEFAULT_MAX_CYCLES) {}
+
+void RegressionSuite::addProgram(const string& name, const vector<string>& sources) {
+    programs.push_back(Program{name, sources, false, Expectation()});
+}
+
+// Writes the built-in workloads to directory and adds them to the corpus
+// with their expected final state; returns the files written so the
+// caller can remove them.
+vector<string> RegressionSuite::addSyntheticWorkloads(const string& directory) {
+    typedef string (*Workload)(Expectation&);
+    const pair<const char*, Workload> workloads[] = {
+        {"sum_array", sumArray},           {"bubble_sort", bubbleSort},         {"fibonacci", fibonacci},
+        {"matrix_product", matrixProduct}, {"halve_array", halveArray},         {"copy_gather", copyGather},
+        {"signed_index", signedIndex},     {"writeback_walk", writebackWalk},   {"inline_calls", inlineCalls},
+        {"unfused_branches", unfusedBranches}};
+
+    vector<string> files;
+    for (const auto& workload : workloads) {
+        Program program = {workload.first, {directory + "/" + workload.first + ".arm"}, true, Expectation()};
+        ofstream out(program.sources[0]);
+        out << workload.second(program.expected);
+        if (!out.good())
+            continue;
+        files.push_back(program.sources[0]);
+        programs.push_back(program);
+    }
+    return files;
+}
+
+static int labelAddress(const HackLinker& linker, const vector<HackObject>& objects, const string& label) {
+    for (size_t m = 0; m < objects.size(); m++) {
+        auto variable = objects[m].variables.find(label);
+        if (variable != objects[m].variables.end())
+            return linker.dataBase(m) + variable->second;
+    }
+    return -1;
+}
+
+// Registers the expectation does not name must be zero, and SP must be back
+// at the top of the stack.
+static string checkExpectation(const Expectation& expected, const HackEmulator& emulator,
+                               const HackLinker& linker, const vector<HackObject>& objects) {
+    for (const string& feature : expected.features) {
+        int total = 0;
+        for (const HackObject& object : objects) {
+            auto stat = object.stats.find(feature);
+            total += stat == object.stats.end() ? 0 : stat->second;
+        }
+        if (total <= 0)
+            return "translation reports no " + feature;
+    }
+
+    for (int r = 0; r < STATE_REGISTERS; r++) {
+        int value = r == SP_REGISTER ? MemoryPlanner::STACK_START : 0;
+        auto literal = expected.registers.find(r);
+        auto pointer = expected.pointers.find(r);
+        if (literal != expected.registers.end())
+            value = literal->second;
+        if (pointer != expected.pointers.end())
+            value = labelAddress(linker, objects, pointer->second.first) + pointer->second.second;
+        if (emulator.peek(r) != (int16_t)value)
+            return "R" + to_string(r) + " is " + to_string(emulator.peek(r)) + ", expected " + to_string(value);
+    }
+
+    for (const auto& data : expected.data) {
+        int address = labelAddress(linker, objects, data.first);
+        if (address < 0)
+            return "no data label " + data.first;
+        for (size_t i = 0; i < data.second.size(); i++) {
+            if (emulator.peek(address + i) != (int16_t)data.second[i])
+                return data.first + "[" + to_string(i) + "] is " + to_string(emulator.peek(address + i)) +
+                       ", expected " + to_string(data.second[i]);
+        }
+    }
+    return "";
+}
+
+// Addresses inside the data area are hashed as offsets from its start, so
+// a data area moved by a different scratch layout keeps the same state.
+RegressionResult RegressionSuite::runProgram(const Program& program) const {
+    RegressionResult result = {program.name, 0, 0, "", ""};
+
+    HackLinker linker;
+    vector<HackObject> objects;
+    for (const string& source : program.sources) {
+        ArmToHack translator;
+        translator.setInlineThreshold(inline_threshold);
+        HackObject object;
+        if (!translator.compileModule(source, object)) {
+            result.error = "cannot translate " + source;
+            return result;
+        }
+        linker.addObject(object);
+        objects.push_back(object);
+    }
+    if (!linker.link()) {
+        result.error = linker.errors().empty() ? "link failed" : linker.errors().front();
+        return result;
+    }
+
+    HackEmulator emulator;
+    if (!emulator.load(linker.output()) || !emulator.run(max_cycles)) {
+        result.error = emulator.error();
+        return result;
+    }
+    result.rom = emulator.romSize();
+    result.cycles = emulator.cycles();
+    if (program.has_expectation) {
+        result.error = checkExpectation(program.expected, emulator, linker, objects);
+        if (!result.error.empty())
+            return result;
+    }
+
+    int data_start = HackEmulator::RAM_SIZE;
+    int data_end = 0;
+    for (size_t m = 0; m < objects.size(); m++) {
+        if (objects[m].data.empty())
+            continue;
+        data_start = min(data_start, linker.dataBase(m));
+        data_end = max(data_end, linker.dataBase(m) + (int)objects[m].data.size());
+    }
+
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash, data_start, data_end](int value) {
+        bool address = value >= data_start && value < data_end;
+        uint32_t word = address ? 0x10000u + (value - data_start) : (uint16_t)value;
+        for (int shift = 0; shift < 32; shift += 8) {
+            hash ^= (word >> shift) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    };
+    for (int r = 0; r < STATE_REGISTERS; r++)
+        mix(emulator.peek(r));
+    for (size_t m = 0; m < objects.size(); m++) {
+        for (size_t i = 0; i < objects[m].data.size(); i++)
+            mix(emulator.peek(linker.dataBase(m) + i));
+    }
+
+    ostringstream state;
+    state << hex << setw(16) << setfill('0') << hash;
+    result.state = state.str();
+    return result;
+}
+
+vector<RegressionResult> RegressionSuite::runAll() const {
+    vector<RegressionResult> results;
+    for (const Program& program : programs)
+        results.push_back(runProgram(program));
+    return results;
+}
+
+bool RegressionSuite::readGolden(const string& filename, map<string, RegressionResult>& golden) const {
+    ifstream in(filename);
+    if (!in.is_open())
+        return false;
+
+    string line;
+    while (getline(in, line)) {
+        istringstream fields(line);
+        string keyword;
+        RegressionResult entry;
+        if (fields >> keyword && keyword == "PROGRAM" && fields >> entry.name >> entry.rom >> entry.cycles >> entry.state)
+            golden[entry.name] = entry;
+    }
+    return true;
+}
+
+static string change(long before, long after) {
+    ostringstream text;
+    text << after;
+    if (after != before)
+        text << " (" << (after > before ? "+" : "") << after - before << ")";
+    return text.str();
+}
+
+static bool exceeds(long before, long after, double threshold_percent) {
+    return after > before + before * threshold_percent / 100.0;
+}
+
+bool RegressionSuite::check(const string& golden_filename, double threshold_percent, ostream& report) const {
+    map<string, RegressionResult> golden;
+    if (!readGolden(golden_filename, golden)) {
+        report << "cannot read golden file " << golden_filename << endl;
+        return false;
+    }
+
+    int failures = 0;
+    for (const RegressionResult& result : runAll()) {
+        report << "  " << left << setw(18) << result.name << right;
+        auto expected = golden.find(result.name);
+        if (!result.error.empty()) {
+            report << "FAIL " << result.error << endl;
+            failures++;
+            if (expected != golden.end())
+                golden.erase(expected);
+            continue;
+        }
+        if (expected == golden.end()) {
+            report << "FAIL not in the golden file (rom " << result.rom << ", cycles " << result.cycles << ")"
+                   << endl;
+            failures++;
+            continue;
+        }
+
+        const RegressionResult& before = expected->second;
+        bool differs = result.state != before.state;
+        bool regressed = exceeds(before.rom, result.rom, threshold_percent) ||
+                         exceeds(before.cycles, result.cycles, threshold_percent);
+        if (differs || regressed)
+            failures++;
+        report << (differs || regressed ? "FAIL" : "ok  ") << " rom " << change(before.rom, result.rom)
+               << ", cycles " << change(before.cycles, result.cycles)
+               << (differs ? ", final state differs" : "") << endl;
+        golden.erase(expected);
+    }
+
+    for (const auto& missing : golden) {
+        report << "  " << left << setw(18) << missing.first << right << "FAIL not in the corpus" << endl;
+        failures++;
+    }
+    report << failures << " failed" << endl;
+    return failures == 0;
+}
+
+bool RegressionSuite::update(const string& golden_filename, ostream& report) const {
+    vector<RegressionResult> results = runAll();
+    for (const RegressionResult& result : results) {
+        if (!result.error.empty()) {
+            report << result.name << ": " << result.error << endl;
+            return false;
+        }
+    }
+
+    ofstream out(golden_filename);
+    out << "# PROGRAM name rom cycles state" << endl;
+    for (const RegressionResult& result : results)
+        out << "PROGRAM " << result.name << " " << result.rom << " " << result.cycles << " " << result.state << endl;
+    if (!out.good()) {
+        report << "cannot write golden file " << golden_filename << endl;
+        return false;
+    }
+    report << "wrote " << results.size() << " programs to " << golden_filename << endl;
+    return true;
+}
@@ -0,0 +1,59 @@
+#ifndef REGRESSIONSUITE_H_
+#define REGRESSIONSUITE_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+
+// Outcome of translating, linking and running one corpus program. state is
+// a hash of R0-R13 and every module's data after the program halts.
+struct RegressionResult {
+    std::string name;
+    int rom;
+    long cycles;
+    std::string state;
+    std::string error;
+};
+
+// Final state a synthetic workload must reach, computed from the algorithm
+// rather than from a translation. Pointers are a DCD label plus a word
+// offset; features are stats the translation has to report, so the
+// workload keeps exercising the optimization it was written for.
+struct Expectation {
+    std::map<int, int> registers;
+    std::map<int, std::pair<std::string, int>> pointers;
+    std::map<std::string, std::vector<int>> data;
+    std::vector<std::string> features;
+};
+
+// Performance gate for the generated code. Every program is translated,
+// linked and run to completion on the HackEmulator; ROM size, executed
+// cycles and the final state are compared against a golden file of
+// "PROGRAM name rom cycles state" lines.
+class RegressionSuite {
+private:
+    struct Program {
+        std::string name;
+        std::vector<std::string> sources;
+        bool has_expectation;
+        Expectation expected;
+    };
+
+    std::vector<Program> programs;
+    int inline_threshold;
+    long max_cycles;
+    RegressionResult runProgram(const Program& program) const;
+    std::vector<RegressionResult> runAll() const;
+    bool readGolden(const std::string& filename, std::map<std::string, RegressionResult>& golden) const;
+
+public:
+    static const long DEFAULT_MAX_CYCLES = 50000000;
+    explicit RegressionSuite(int inline_threshold);
+    void addProgram(const std::string& name, const std::vector<std::string>& sources);
+    std::vector<std::string> addSyntheticWorkloads(const std::string& directory);
+    bool check(const std::string& golden_filename, double threshold_percent, std::ostream& report) const;
+    bool update(const std::string& golden_filename, std::ostream& report) const;
+};
+
+#endif
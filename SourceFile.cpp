@@ -0,0 +1,98 @@
+#include "SourceFile.h"
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static const size_t READ_CHUNK = 1 << 16;
+
+SourceFile::SourceFile() : contents(nullptr), length(0), position(0), mapping(nullptr) {}
+
+SourceFile::~SourceFile() {
+    close();
+}
+
+bool SourceFile::open(const string& filename) {
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    bool ok = (fstat(fd, &info) == 0);
+
+    if (ok && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+            mapping = mapped;
+            contents = static_cast<const char*>(mapped);
+            length = info.st_size;
+        } else {
+            buffer.reserve(info.st_size);
+            ok = readAll(fd);
+        }
+    } else if (ok) {
+        ok = readAll(fd);
+    }
+
+    ::close(fd);
+    if (!ok)
+        close();
+    return ok;
+}
+
+bool SourceFile::readAll(int fd) {
+    buffer.clear();
+    size_t used = 0;
+    while (true) {
+        if (buffer.size() - used < READ_CHUNK)
+            buffer.resize(used + READ_CHUNK);
+        ssize_t count = ::read(fd, buffer.data() + used, buffer.size() - used);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (count == 0)
+            break;
+        used += count;
+    }
+    buffer.resize(used);
+    contents = buffer.data();
+    length = used;
+    return true;
+}
+
+void SourceFile::close() {
+    if (mapping != nullptr)
+        munmap(mapping, length);
+    mapping = nullptr;
+    buffer.clear();
+    contents = nullptr;
+    length = 0;
+    position = 0;
+}
+
+bool SourceFile::nextLine(LineView& line) {
+    if (position >= length)
+        return false;
+
+    const char* start = contents + position;
+    const char* end = static_cast<const char*>(memchr(start, '\n', length - position));
+    size_t size = end ? end - start : length - position;
+
+    line.data = start;
+    line.size = size;
+    position += size + 1;
+    return true;
+}
+
+size_t SourceFile::size() const {
+    return length;
+}
@@ -0,0 +1,32 @@
+#ifndef SOURCEFILE_H_
+#define SOURCEFILE_H_
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include "token_io.h"
+
+// Read-only view of a whole ARM source file. Regular files are memory
+// mapped; pipes and other streams are read in one bulk read. Lines are
+// handed out as views into that buffer and stay valid until close().
+class SourceFile {
+private:
+    const char* contents;
+    size_t length;
+    size_t position;
+    void* mapping;
+    std::vector<char> buffer;
+    bool readAll(int fd);
+
+public:
+    SourceFile();
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+    ~SourceFile();
+    bool open(const std::string& filename);
+    void close();
+    bool nextLine(LineView& line);
+    size_t size() const;
+};
+
+#endif
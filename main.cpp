@@ -1,40 +1,167 @@
 #include <string>
 #include <map>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "token_io.h"
 #include "ArmToHack.h"
+#include "HackLinker.h"
+#include "RegressionSuite.h"
 
 using namespace std;
 
-int main() {
+static const char* const TEST_PROGRAMS[] = {
+    "program1",  "program2",  "program3",  "program4",  "program5",    "program6",    "program7",
+    "program8",  "program9",  "program10", "program11", "program12",   "program13",   "program14",
+    "program15", "program16", "program17", "program18", "program19",   "program20",   "program21",
+    "program22", "program23", "programASR1", "programASR2", "programASR3"};
+
+// An object is reused only if it is newer than its source, in the current
+// format and translated with the same options.
+static bool isOutOfDate(const string& source, const string& object, int inline_threshold) {
+    struct stat source_info, object_info;
+    if (stat(source.c_str(), &source_info) != 0)
+        return true;
+    if (stat(object.c_str(), &object_info) != 0)
+        return true;
+    if (object_info.st_mtime <= source_info.st_mtime)
+        return true;
+
+    HackObject previous;
+    if (!readObject(previous, object))
+        return true;
+    auto threshold = previous.options.find("inline_threshold");
+    return threshold == previous.options.end() || threshold->second != inline_threshold;
+}
+
+static string objectFilename(const string& source) {
+    size_t dot = source.rfind('.');
+    if (dot == string::npos || source.find('/', dot) != string::npos)
+        return source + ".obj";
+    return source.substr(0, dot) + ".obj";
+}
+
+// Translates every out-of-date module on at most one worker per hardware
+// thread, each taking the next module from a shared index, then links all
+// objects.
+static int buildProgram(const vector<string>& sources, const string& out_filename,
+                        const string& map_filename, int inline_threshold) {
+    vector<string> objects;
+    vector<size_t> stale;
+    vector<char> compiled(sources.size(), 1);
+
+    for (size_t i = 0; i < sources.size(); i++) {
+        objects.push_back(objectFilename(sources[i]));
+        if (isOutOfDate(sources[i], objects[i], inline_threshold))
+            stale.push_back(i);
+    }
+
+    atomic<size_t> next(0);
+    auto work = [&sources, &objects, &compiled, &stale, &next, inline_threshold]() {
+        for (size_t s = next++; s < stale.size(); s = next++) {
+            size_t i = stale[s];
+            ArmToHack translator;
+            translator.setInlineThreshold(inline_threshold);
+            compiled[i] = translator.compileFile(sources[i], objects[i]);
+        }
+    };
+
+    size_t count = min<size_t>(max(thread::hardware_concurrency(), 1u), stale.size());
+    vector<thread> workers;
+    for (size_t w = 0; w < count; w++)
+        workers.push_back(thread(work));
+    for (thread& worker : workers)
+        worker.join();
+
+    HackLinker linker;
+    for (size_t i = 0; i < sources.size(); i++) {
+        if (!compiled[i]) {
+            cerr << "cannot translate " << sources[i] << endl;
+            return 1;
+        }
+        linker.addObjectFile(objects[i]);
+    }
+
+    bool linked = linker.link(out_filename);
+    if (!map_filename.empty() && !linker.writeMemoryMap(map_filename))
+        cerr << "cannot write memory map " << map_filename << endl;
+    for (const string& error : linker.errors())
+        cerr << error << endl;
+    return linked ? 0 : 1;
+}
+
+// Runs the test programs that are present plus the synthetic workloads
+// and checks them against, or with update rewrites, the golden file.
+static int runRegression(const string& golden_filename, double threshold_percent, bool update,
+                         int inline_threshold) {
+    RegressionSuite suite(inline_threshold);
+    for (const char* program : TEST_PROGRAMS) {
+        string source = string("test/") + program + ".arm";
+        struct stat info;
+        if (stat(source.c_str(), &info) == 0)
+            suite.addProgram(program, {source});
+    }
+
+    char directory[] = "/tmp/armtohack-XXXXXX";
+    if (!mkdtemp(directory)) {
+        cerr << "cannot create a directory for the synthetic workloads" << endl;
+        return 1;
+    }
+    vector<string> workloads = suite.addSyntheticWorkloads(directory);
+
+    bool passed = update ? suite.update(golden_filename, cout)
+                         : suite.check(golden_filename, threshold_percent, cout);
+
+    for (const string& workload : workloads)
+        remove(workload.c_str());
+    rmdir(directory);
+    return passed ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        string out_filename = "a.asm";
+        string map_filename;
+        int inline_threshold = ArmToHack::DEFAULT_INLINE_THRESHOLD;
+        string golden_filename;
+        double threshold_percent = 1.0;
+        bool update = false;
+        vector<string> sources;
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "-o" && i + 1 < argc) {
+                out_filename = argv[++i];
+            } else if (arg == "-m" && i + 1 < argc) {
+                map_filename = argv[++i];
+            } else if (arg == "-i" && i + 1 < argc) {
+                inline_threshold = stoi(argv[++i]);
+            } else if (arg == "--regress" && i + 1 < argc) {
+                golden_filename = argv[++i];
+            } else if (arg == "-t" && i + 1 < argc) {
+                threshold_percent = stod(argv[++i]);
+            } else if (arg == "--update") {
+                update = true;
+            } else {
+                sources.push_back(arg);
+            }
+        }
+        if (!golden_filename.empty())
+            return runRegression(golden_filename, threshold_percent, update, inline_threshold);
+        return buildProgram(sources, out_filename, map_filename, inline_threshold);
+    }
+
     ArmToHack translator;
     
-    translator.convertFile("test/program1.arm", "test/program1.asm");
-    translator.convertFile("test/program2.arm", "test/program2.asm");
-    translator.convertFile("test/program3.arm", "test/program3.asm");
-    translator.convertFile("test/program4.arm", "test/program4.asm");
-    translator.convertFile("test/program5.arm", "test/program5.asm");
-    translator.convertFile("test/program6.arm", "test/program6.asm");
-    translator.convertFile("test/program7.arm", "test/program7.asm");
-    translator.convertFile("test/program8.arm", "test/program8.asm");
-    translator.convertFile("test/program9.arm", "test/program9.asm");
-    translator.convertFile("test/program10.arm", "test/program10.asm");
-    translator.convertFile("test/program11.arm", "test/program11.asm");
-    translator.convertFile("test/program12.arm", "test/program12.asm");
-    translator.convertFile("test/program13.arm", "test/program13.asm");
-    translator.convertFile("test/program14.arm", "test/program14.asm");
-    translator.convertFile("test/program15.arm", "test/program15.asm");
-    translator.convertFile("test/program16.arm", "test/program16.asm");
-    translator.convertFile("test/program17.arm", "test/program17.asm");
-    translator.convertFile("test/program18.arm", "test/program18.asm");
-    translator.convertFile("test/program19.arm", "test/program19.asm");
-    translator.convertFile("test/program20.arm", "test/program20.asm");
-    translator.convertFile("test/program21.arm", "test/program21.asm");
-    translator.convertFile("test/program22.arm", "test/program22.asm");
-    translator.convertFile("test/program23.arm", "test/program23.asm");
-    translator.convertFile("test/programASR1.arm", "test/programASR1.asm");
-    translator.convertFile("test/programASR2.arm", "test/programASR2.asm");
-    translator.convertFile("test/programASR3.arm", "test/programASR3.asm");
+    for (const char* program : TEST_PROGRAMS) {
+        string name = program;
+        translator.convertFile("test/" + name + ".arm", "test/" + name + ".asm");
+    }
     
     return 0;
 }
-
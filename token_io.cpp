@@ -3,24 +3,80 @@
 
 #include <string>
 #include <istream>
-#include <sstream>
-#include <regex>
+#include <cctype>
 using namespace std;
 
 
+static bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+
 string getNextLine(istream& input)
 {
     string line;
     getline(input, line, '\n');
 
-    regex remove_comma(",");
-    line = regex_replace(line, remove_comma, " ");
-    regex trim_ws("^\\s+|\\s+$");
-    line = regex_replace(line, trim_ws, "");
-    regex pack_ws("\\s+");
-    line = regex_replace(line, pack_ws, " ");
+    string normalized;
+    normalizeLine(LineView{line.data(), line.size()}, normalized);
+    return normalized;
+}
+
+
+void normalizeLine(LineView line, string& out)
+{
+    out.clear();
+    bool pending_space = false;
+    for (size_t i = 0; i < line.size; i++) {
+        char c = line.data[i];
+        if (c == ',' || isSpace(c)) {
+            pending_space = !out.empty();
+            continue;
+        }
+        if (pending_space) {
+            out.push_back(' ');
+            pending_space = false;
+        }
+        out.push_back(c);
+    }
+}
+
+
+LineView takeToken(LineView& input)
+{
+    size_t start = 0;
+    while (start < input.size && (input.data[start] == ',' || isSpace(input.data[start])))
+        start++;
+
+    if (start < input.size && input.data[start] == ';')
+        start = input.size;
+
+    size_t end = start;
+    while (end < input.size && input.data[end] != ',' && input.data[end] != ';' && !isSpace(input.data[end]))
+        end++;
+
+    LineView token = {input.data + start, end - start};
+    input.data += end;
+    input.size -= end;
+    return token;
+}
+
+
+bool tokenEquals(LineView token, const char* text)
+{
+    size_t i = 0;
+    for (; i < token.size; i++) {
+        if (text[i] != token.data[i])
+            return false;
+    }
+    return text[i] == '\0';
+}
 
-    return line;
+
+string toString(LineView view)
+{
+    return string(view.data, view.size);
 }
 
 
@@ -39,25 +95,14 @@ string getSecondToken(string input)
 
 string takeToken(string& input)
 {
-    char delim = ' ';
-
-    regex remove_comment(";.*");
-    input = regex_replace(input, remove_comment, " ");
-    regex remove_comma(",");
-    input = regex_replace(input, remove_comma, " ");
-    regex trim_ws("^\\s+|\\s+$");
-    input = regex_replace(input, trim_ws, "");
-    regex pack_ws("\\s+");
-    input = regex_replace(input, pack_ws, " ");
-    
-    string token;
-    stringstream stream(input);
-    getline(stream, token, delim);
-    token = regex_replace(token, trim_ws, "");
-
-    regex trim_delim(string("^.*?(") + delim + "|$)");
-    input = regex_replace(input, trim_delim, "");
-    input = regex_replace(input, trim_ws, " ");
+    size_t comment = input.find(';');
+    LineView rest = {input.data(), comment == string::npos ? input.size() : comment};
+
+    string token = toString(takeToken(rest));
+
+    string remainder;
+    normalizeLine(rest, remainder);
+    input.swap(remainder);
     
     return token;
 }
@@ -85,3 +130,62 @@ void removeChars(string& str, const string& symbols)
     cut = (cut == string::npos) ? str.size() : cut+1;
     str.erase(cut, str.size());
 }
+
+
+// Splits the address operand of LDR/STR: "[Rn, #imm]", "[Rn, -Rm, LSL #k]",
+// pre-indexed "[...]!" and post-indexed "[Rn], offset". Post-indexing always
+// writes the new address back to the base register.
+MemoryOperand parseMemoryOperand(const string& text)
+{
+    MemoryOperand operand;
+    operand.offset = 0;
+    operand.subtract = false;
+    operand.shift = 0;
+    operand.writeback = false;
+    operand.post_index = false;
+
+    size_t close = text.find(']');
+    string inside = text.substr(0, close);
+    string after = (close == string::npos) ? "" : text.substr(close + 1);
+    removeChars(inside, "[ ");
+    removeChars(after, " ");
+
+    if (!after.empty() && after[0] == '!') {
+        operand.writeback = true;
+        after.erase(0, 1);
+        removeChars(after, " ");
+    }
+
+    operand.base = takeToken(inside);
+    string offset = inside;
+    if (!after.empty()) {
+        operand.post_index = true;
+        operand.writeback = true;
+        offset = after;
+    }
+
+    string token = takeToken(offset);
+    removeChars(token, "#");
+    if (token.empty())
+        return operand;
+
+    if (token[0] == '-' || token[0] == '+') {
+        operand.subtract = (token[0] == '-');
+        token.erase(0, 1);
+    }
+
+    if (!token.empty() && isdigit(token[0])) {
+        operand.offset = operand.subtract ? -stoi(token) : stoi(token);
+        operand.subtract = false;
+        return operand;
+    }
+
+    operand.index = token;
+    if (takeToken(offset) == "LSL") {
+        string amount = takeToken(offset);
+        removeChars(amount, "#");
+        if (!amount.empty())
+            operand.shift = stoi(amount);
+    }
+    return operand;
+}
@@ -4,12 +4,41 @@
 
 #include <string>
 #include <istream>
+#include <cstddef>
 using namespace std;
 
 
+// A line or token inside a larger buffer, e.g. a memory-mapped source file.
+struct LineView {
+    const char* data;
+    size_t size;
+};
+
+
+// One normalized source line; label is set for label-only lines and
+// inlined for lines copied from an inlined function body.
+struct SourceLine {
+    string text;
+    string label;
+    bool inlined = false;
+};
+
+
 string getNextLine(istream& input);
 
 
+void normalizeLine(LineView line, string& out);
+
+
+LineView takeToken(LineView& input);
+
+
+bool tokenEquals(LineView token, const char* text);
+
+
+string toString(LineView view);
+
+
 string getFirstToken(string input);
 
 
@@ -24,4 +53,20 @@ string takeTokenFromEnd(string& input);
 
 void removeChars(string& str, const string& symbols);
 
+
+// Address operand of LDR/STR: base register plus either an immediate
+// offset or an index register, optionally negated and shifted left.
+struct MemoryOperand {
+    string base;
+    string index;
+    int offset;
+    bool subtract;
+    int shift;
+    bool writeback;
+    bool post_index;
+};
+
+
+MemoryOperand parseMemoryOperand(const string& text);
+
 #endif